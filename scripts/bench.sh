@@ -0,0 +1,74 @@
+#!/bin/bash
+
+###########################################################
+# Benchmark ggst on synthetic samples of different sizes.
+#
+# For each event count, generates a sample with ggst-synth
+# (once; the same seed gives the same files), runs ggst
+# with --profile, and prints the event rate. With a
+# baseline directory (from an earlier run, see
+# "make bench-baseline"), rates are compared against it,
+# and the exit status is 1 if any is slower by more than
+# BENCH_TOLERANCE (default 0.1, i.e. 10%).
+#
+# Usage: scripts/bench.sh [-b BASELINE_DIR] N...
+#
+# Extra ggst options can be passed in BENCH_FLAGS, e.g.
+# BENCH_FLAGS="--threads 4 --block 4096".
+###########################################################
+
+BENCH="${BENCH_DIR:-bench}"
+TOLERANCE="${BENCH_TOLERANCE:-0.1}"
+BASELINE=""
+
+if [ "${1}" == "-b" ]; then
+  BASELINE="${2}"
+  shift 2
+fi
+
+if [ $# -eq 0 ]; then
+  echo "Usage: ${0} [-b BASELINE_DIR] N..."
+  exit 0
+fi
+
+TOP="$(pwd)"
+SAMPLE="Synthetic_Default+CCMEC"
+FAILED=0
+
+rate() {
+  sed -n 's/.*"events_per_second": \([0-9.e+-]*\).*/\1/p' "${1}"
+}
+
+printf "%12s %16s %16s %8s\n" "events" "events/s" "baseline" "ratio"
+
+for N in "$@"; do
+  DIR="${BENCH}/${N}"
+  mkdir -p "${DIR}"
+
+  # About 100k events per file, like the grid output
+  if [ ! -d "${DIR}/${SAMPLE}_1" ]; then
+    NFILES=$(( (N + 99999) / 100000 ))
+    "${TOP}/ggst-synth" --events "${N}" --files "${NFILES}" --seed 1 \
+      "${DIR}" > "${DIR}/synth.log" 2>&1 || { echo "ggst-synth failed for ${N}"; exit 1; }
+  fi
+
+  (cd "${DIR}" && "${TOP}/ggst" --profile --no-render ${BENCH_FLAGS} \
+     "${SAMPLE}_1/gntp.*.ghep.gst.root" > ggst.log 2>&1) \
+    || { echo "ggst failed for ${N}, see ${DIR}/ggst.log"; exit 1; }
+
+  R=$(rate "${DIR}/${SAMPLE}.profile.json")
+  B="-"
+  RATIO="-"
+  if [ -n "${BASELINE}" ] && [ -f "${BASELINE}/${N}.profile.json" ]; then
+    B=$(rate "${BASELINE}/${N}.profile.json")
+    RATIO=$(awk -v r="${R}" -v b="${B}" 'BEGIN { printf "%.3f", r / b }')
+    if awk -v x="${RATIO}" -v t="${TOLERANCE}" 'BEGIN { exit !(x < 1 - t) }'; then
+      RATIO="${RATIO} SLOWER"
+      FAILED=1
+    fi
+  fi
+
+  printf "%12s %16s %16s %8s\n" "${N}" "${R}" "${B}" "${RATIO}"
+done
+
+exit ${FAILED}
@@ -0,0 +1,67 @@
+#!/bin/bash
+
+###########################################################
+# Checks run by "make test", over synthetic samples.
+#
+# Generates the samples with ggst-synth (once; the same
+# seed gives the same files), then checks that:
+#
+#   * the per-entry event loop makes no heap allocations
+#     (test-alloc),
+#   * the batch kernels of --block give the same results
+#     as the scalar getters for every event
+#     (ggst --check-kernels), and
+#   * a preview with the default plan stops before reading
+#     all of a larger sample (ggst --preview).
+#
+# Prints a line per check, and the exit status is 1 if
+# any fails; logs are left in TEST_DIR (default test).
+#
+# Usage: scripts/test.sh
+###########################################################
+
+TEST="${TEST_DIR:-test}"
+TOP="$(pwd)"
+SAMPLE="Synthetic_Default+CCMEC"
+FAILED=0
+
+# A synthetic sample of N events in F files, in directory D
+sample() {
+  if [ ! -d "${3}/${SAMPLE}_1" ]; then
+    mkdir -p "${3}"
+    "${TOP}/ggst-synth" --events "${1}" --files "${2}" --seed 1 \
+      "${3}" > "${3}/synth.log" 2>&1 || { echo "ggst-synth failed in ${3}"; exit 1; }
+  fi
+}
+
+# Print the result of a check
+result() {
+  if [ "${2}" -eq 0 ]; then
+    printf "%-10s ok\n" "${1}"
+  else
+    printf "%-10s FAILED, see %s\n" "${1}" "${3}"
+    FAILED=1
+  fi
+}
+
+sample 10000 1 "${TEST}"
+
+"${TOP}/test-alloc" "${TEST}/${SAMPLE}_1/gntp.0.ghep.gst.root" \
+  > "${TEST}/alloc.log" 2>&1
+result alloc $? "${TEST}/alloc.log"
+
+(cd "${TEST}" && "${TOP}/ggst" --no-render --block 4096 --check-kernels \
+   "${SAMPLE}_1/gntp.*.ghep.gst.root" > kernels.log 2>&1) \
+  && grep -q "^Kernel check: 0 of" "${TEST}/kernels.log" \
+  && ! grep -q "^Kernel check: [1-9]" "${TEST}/kernels.log"
+result kernels $? "${TEST}/kernels.log"
+
+# The last round's "Preview: READ of TOTAL entries" must have READ < TOTAL
+sample 1000000 10 "${TEST}/preview"
+(cd "${TEST}/preview" && "${TOP}/ggst" --no-render --preview 0.5 \
+   "${SAMPLE}_1/gntp.*.ghep.gst.root" > preview.log 2>&1) \
+  && awk '/^Preview: [0-9]/ { read = $2; total = $4 }
+          END { exit !(read > 0 && read < total) }' "${TEST}/preview/preview.log"
+result preview $? "${TEST}/preview/preview.log"
+
+exit ${FAILED}
@@ -0,0 +1,246 @@
+/**
+ * Native fixed-binning histograms, with the binning known at compile time.
+ *
+ * Bin contents live in one contiguous array, laid out as in ROOT (bin 0 is
+ * the underflow, nbins+1 the overflow, and y-major for 2D), and are copied
+ * into the matching TH1/TH2 only when writing. Bin lookup follows
+ * TAxis::FindFixBin exactly, so the contents are the same as filling the
+ * ROOT histogram directly.
+ *
+ * The statistics sums (sum of weights, of x, of x^2, ...; see TH1::GetStats)
+ * are kept as ROOT keeps them, from the values filled into the bins in
+ * range, and set with TH1::PutStats on copying, so the means and RMSs are
+ * exact rather than computed from the bin centres.
+ */
+
+#include <cstring>
+#include <stdint.h>
+#include <TH1.h>
+
+/**
+ * A fixed-width axis: N bins over [Lo/Den, Hi/Den).
+ *
+ * The edges are given as integer ratios (non-type template parameters can't
+ * be floating point); e.g. Axis<100, 0, 1250> is 100 bins over [0, 1.25].
+ */
+template<int N, int Lo, int Hi, int Den=1000>
+struct Axis {
+  static const int nbins = N;
+
+  static double min() { return 1.0 * Lo / Den; }
+
+  static double max() { return 1.0 * Hi / Den; }
+
+  /** Bin index for x, as in TAxis::FindFixBin. */
+  static int Bin(double x) {
+    if (x < min()) {
+      return 0;
+    }
+    else if (!(x < max())) {  // Also catches NaN
+      return N + 1;
+    }
+    return 1 + int(N * (x - min()) / (max() - min()));
+  }
+
+  /**
+   * Fine bin index for x, with k fine bins per bin: the bin from Bin,
+   * subdivided, so the fine bins nest exactly in the bins (fine bins
+   * (b-1)*k+1 ... b*k make up bin b; 0 and N*k+1 are the under- and
+   * overflow).
+   */
+  static int FineBin(double x, int k) {
+    int bin = Bin(x);
+    if (bin == 0 || bin == N + 1) {
+      return (bin == 0 ? 0 : N * k + 1);
+    }
+    double t = N * (x - min()) / (max() - min()) - (bin - 1);
+    int sub = int(k * t);
+    return 1 + (bin - 1) * k + (sub < 0 ? 0 : sub < k ? sub : k - 1);
+  }
+};
+
+
+/** A 1D histogram with axis X. */
+template<class X>
+class Bins1 {
+public:
+  static const int ndim = 1;
+  static const int ncells = X::nbins + 2;
+
+  static const int nstats = 4;
+
+  Bins1() : entries(0) {
+    memset(bins, 0, sizeof(bins));
+    memset(stats, 0, sizeof(stats));
+  }
+
+  /** Index of the cell holding x. */
+  static int Cell(double x) { return X::Bin(x); }
+
+  /** Index of the fine cell (k per bin) holding v[0]. */
+  static int64_t FineCell(const double* v, int k) { return X::FineBin(v[0], k); }
+
+  /** The fine binning, as bins, low and high edges. */
+  static void FineAxes(int k, int* n, double* lo, double* hi) {
+    n[0] = X::nbins * k;
+    lo[0] = X::min();
+    hi[0] = X::max();
+  }
+
+  void Fill(double x) {
+    FillCell(Cell(x), x);
+  }
+
+  /** Fill x, whose cell (from Cell) is already known. */
+  void FillCell(int cell, double x) {
+    bins[cell] += 1;
+    entries++;
+    if (cell > 0 && cell <= X::nbins) {
+      stats[0] += 1;
+      stats[1] += 1;
+      stats[2] += x;
+      stats[3] += x * x;
+    }
+  }
+
+  /** Fill n values at once. */
+  void FillN(const double* x, size_t n) {
+    for (size_t i=0; i<n; i++) {
+      FillCell(X::Bin(x[i]), x[i]);
+    }
+  }
+
+  void Add(const Bins1& other) {
+    for (int i=0; i<ncells; i++) {
+      bins[i] += other.bins[i];
+    }
+    for (int i=0; i<nstats; i++) {
+      stats[i] += other.stats[i];
+    }
+    entries += other.entries;
+  }
+
+  /** Add the contents of a ROOT histogram with the same binning. */
+  void Add(const TH1* h) {
+    for (int i=0; i<ncells; i++) {
+      bins[i] += h->GetBinContent(i);
+    }
+    double s[TH1::kNstat];
+    h->GetStats(s);
+    for (int i=0; i<nstats; i++) {
+      stats[i] += s[i];
+    }
+    entries += h->GetEntries();
+  }
+
+  /** Set the contents of a ROOT histogram with the same binning. */
+  void Copy(TH1* h) const {
+    for (int i=0; i<ncells; i++) {
+      h->SetBinContent(i, bins[i]);
+    }
+    h->SetEntries(entries);
+    h->PutStats(const_cast<double*>(stats));
+  }
+
+  double bins[ncells];
+  double stats[nstats];  //!< Sums of w, w^2, wx, wx^2 over fills in range
+  double entries;
+};
+
+
+/** A 2D histogram with axes X and Y. */
+template<class X, class Y>
+class Bins2 {
+public:
+  static const int ndim = 2;
+  static const int nx = X::nbins + 2;
+  static const int ncells = nx * (Y::nbins + 2);
+
+  static const int nstats = 7;
+
+  Bins2() : entries(0) {
+    memset(bins, 0, sizeof(bins));
+    memset(stats, 0, sizeof(stats));
+  }
+
+  /** Index of the cell holding (x, y). */
+  static int Cell(double x, double y) { return X::Bin(x) + nx * Y::Bin(y); }
+
+  /** Index of the fine cell (k per bin and axis) holding (v[0], v[1]). */
+  static int64_t FineCell(const double* v, int k) {
+    return X::FineBin(v[0], k) + (int64_t) (X::nbins * k + 2) * Y::FineBin(v[1], k);
+  }
+
+  /** The fine binning, as bins, low and high edges per axis. */
+  static void FineAxes(int k, int* n, double* lo, double* hi) {
+    n[0] = X::nbins * k;
+    lo[0] = X::min();
+    hi[0] = X::max();
+    n[1] = Y::nbins * k;
+    lo[1] = Y::min();
+    hi[1] = Y::max();
+  }
+
+  void Fill(double x, double y) {
+    FillCell(Cell(x, y), x, y);
+  }
+
+  /** Fill (x, y), whose cell (from Cell) is already known. */
+  void FillCell(int cell, double x, double y) {
+    bins[cell] += 1;
+    entries++;
+    int bx = cell % nx, by = cell / nx;
+    if (bx > 0 && bx <= X::nbins && by > 0 && by <= Y::nbins) {
+      stats[0] += 1;
+      stats[1] += 1;
+      stats[2] += x;
+      stats[3] += x * x;
+      stats[4] += y;
+      stats[5] += y * y;
+      stats[6] += x * y;
+    }
+  }
+
+  /** Fill n (x, y) pairs at once. */
+  void FillN(const double* x, const double* y, size_t n) {
+    for (size_t i=0; i<n; i++) {
+      FillCell(Cell(x[i], y[i]), x[i], y[i]);
+    }
+  }
+
+  void Add(const Bins2& other) {
+    for (int i=0; i<ncells; i++) {
+      bins[i] += other.bins[i];
+    }
+    for (int i=0; i<nstats; i++) {
+      stats[i] += other.stats[i];
+    }
+    entries += other.entries;
+  }
+
+  /** Add the contents of a ROOT histogram with the same binning. */
+  void Add(const TH1* h) {
+    for (int i=0; i<ncells; i++) {
+      bins[i] += h->GetBinContent(i);
+    }
+    double s[TH1::kNstat];
+    h->GetStats(s);
+    for (int i=0; i<nstats; i++) {
+      stats[i] += s[i];
+    }
+    entries += h->GetEntries();
+  }
+
+  /** Set the contents of a ROOT histogram with the same binning. */
+  void Copy(TH1* h) const {
+    for (int i=0; i<ncells; i++) {
+      h->SetBinContent(i, bins[i]);
+    }
+    h->SetEntries(entries);
+    h->PutStats(const_cast<double*>(stats));
+  }
+
+  double bins[ncells];
+  double stats[nstats];  //!< Sums of w, w^2, wx, wx^2, wy, wy^2, wxy over fills in range
+  double entries;
+};
@@ -0,0 +1,340 @@
+/**
+ * Block-wise reading of GST entries into structure-of-arrays buffers.
+ *
+ * An EventBlock holds up to capacity consecutive entries, one column per
+ * active branch. Per-particle branches are stored back to back, indexed by
+ * per-event offsets, so a block takes space for the particles it actually
+ * has rather than kNPmax per event.
+ *
+ * A compact block also narrows the particle columns: doubles (energy and
+ * momenta) are stored as floats, and integers (PDG codes) as 16-bit indices
+ * into a table of the codes seen in the block. This halves the particle
+ * memory, at the cost of float precision in the particle kinematics.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <TTree.h>
+
+/**
+ * \class EventBlock
+ * \brief Structure-of-arrays buffers for a block of events.
+ */
+class EventBlock {
+public:
+  static const size_t kDefaultSize = 4096;
+  static const long kMinCacheSize = 4 * 1024 * 1024;  //!< Smallest TTreeCache, in bytes
+
+  EventBlock(Event& _ev, size_t _capacity=kDefaultSize, bool _compact=false)
+      : ev(_ev), capacity(_capacity), n(0), first(0), compact(_compact),
+        columns(_ev.bindings.size()), offsets(_ev.bindings.size()),
+        valid(_capacity), cached(false) {
+    for (size_t i=0; i<ev.bindings.size(); i++) {
+      active.push_back(i);
+      if (ev.bindings[i].count) {
+        offsets[i].resize(capacity + 1, 0);
+      }
+      else {
+        columns[i].resize(capacity * ev.bindings[i].size);
+      }
+    }
+  }
+
+  /** Buffer only the given branches (and the particle counts they need). */
+  void SetActive(const std::set<std::string>& names) {
+    if (names.count("*")) {
+      return;
+    }
+
+    std::set<std::string> all(names);
+    for (size_t i=0; i<ev.bindings.size(); i++) {
+      if (ev.bindings[i].count && names.count(ev.bindings[i].name)) {
+        all.insert(ev.BranchName(ev.bindings[i].count));
+      }
+    }
+
+    active.clear();
+    for (size_t i=0; i<ev.bindings.size(); i++) {
+      if (all.count(ev.bindings[i].name)) {
+        active.push_back(i);
+      }
+    }
+  }
+
+  /** Bytes per stored particle of binding b. */
+  size_t ParticleSize(const Event::Binding& b) const {
+    size_t size = b.size / Event::kNPmax;
+    if (compact && (size == sizeof(double) || size == sizeof(int))) {
+      return size / 2;
+    }
+    return size;
+  }
+
+  /** Copy binding k of the Event into row j of its column. */
+  void Store(size_t j, size_t k) {
+    const Event::Binding& b = ev.bindings[k];
+
+    if (b.count) {
+      size_t size = ParticleSize(b);
+      uint32_t end = offsets[k][j] + *b.count;
+      if (columns[k].size() < end * size) {
+        columns[k].resize(2 * end * size);
+      }
+      char* dst = &columns[k][offsets[k][j] * size];
+      if (size != b.size / Event::kNPmax) {
+        Narrow(b, dst, *b.count);
+      }
+      else if (*b.count > 0) {
+        memcpy(dst, b.addr, *b.count * size);
+      }
+      offsets[k][j+1] = end;
+    }
+    else {
+      memcpy(&columns[k][j * b.size], b.addr, b.size);
+    }
+  }
+
+  /**
+   * Save the Features computed so far for row j.
+   *
+   * The Features array is only allocated once something is kept, so blocks
+   * that are only loaded (e.g. in a MemoryEvent) don't carry it.
+   */
+  void Keep(size_t j) {
+    if (feat.empty()) {
+      feat.resize(capacity);
+    }
+    feat[j] = ev.feat;
+    valid[j] = ev.valid;
+  }
+
+  /** Copy row j into the Event members, with its saved Features. */
+  void Load(size_t j) {
+    Load(j, ev);
+  }
+
+  /**
+   * Copy row j into the members of another Event, e.g. one on another
+   * thread (see prefetch.h). Bindings are the same for every Event.
+   */
+  void Load(size_t j, Event& to) {
+    for (size_t i=0; i<active.size(); i++) {
+      size_t k = active[i];
+      const Event::Binding& b = to.bindings[k];
+
+      if (b.count) {
+        size_t size = ParticleSize(b);
+        size_t len = offsets[k][j+1] - offsets[k][j];
+        const char* src = &columns[k][offsets[k][j] * size];
+        if (size != b.size / Event::kNPmax) {
+          Widen(b, src, len);
+        }
+        else if (len > 0) {
+          memcpy(b.addr, src, len * size);
+        }
+      }
+      else {
+        memcpy(b.addr, &columns[k][j * b.size], b.size);
+      }
+    }
+
+    to.valid = valid[j];
+    if (to.valid) {
+      to.feat = feat[j];
+    }
+    to.entry = first + j;
+  }
+
+  /** The column for a scalar branch, or NULL if it isn't buffered. */
+  template<class T>
+  const T* Column(const std::string& name) const {
+    for (size_t i=0; i<active.size(); i++) {
+      const Event::Binding& b = ev.bindings[active[i]];
+      if (b.name == name && !b.count && b.size == sizeof(T)) {
+        return (const T*) &columns[active[i]][0];
+      }
+    }
+    return NULL;
+  }
+
+  /**
+   * The values of a particle branch, or NULL if it isn't buffered (or is
+   * compact). The particles of row j are [off[j], off[j+1]).
+   */
+  template<class T>
+  const T* Particles(const std::string& name, const uint32_t*& off) const {
+    for (size_t i=0; i<active.size(); i++) {
+      const Event::Binding& b = ev.bindings[active[i]];
+      if (b.name == name && b.count && ParticleSize(b) == sizeof(T) &&
+          b.size / Event::kNPmax == sizeof(T)) {
+        off = offsets[active[i]].data();
+        return (const T*) columns[active[i]].data();
+      }
+    }
+    return NULL;
+  }
+
+  /**
+   * Read entries [first, first + n) into the block.
+   *
+   * For trees, the block stops at the end of the current file's tree, and
+   * the branches are read one after the other, each for the whole block,
+   * so one basket at a time is decompressed and copied out. Each value is
+   * still read with a TBranch::GetEntry per entry (ROOT's bulk reads don't
+   * handle the variable-length particle arrays), but the baskets come from
+   * a TTreeCache sized to the block (see Cache), fetched in a few large
+   * reads. Other Event types (e.g. a CacheEvent) are read entry by entry.
+   * Returns the number of entries read.
+   */
+  size_t Read(long _first, size_t _n) {
+    first = _first;
+    n = std::min(_n, capacity);
+
+    if (!ev.gst) {
+      for (size_t j=0; j<n; j++) {
+        ev.GetEntry(first + j);
+        for (size_t i=0; i<active.size(); i++) {
+          Store(j, active[i]);
+        }
+        Keep(j);
+      }
+      return n;
+    }
+
+    long local = ev.gst->LoadTree(first);
+    TTree* t = ev.gst->GetTree();
+    if (local < 0 || !t) {
+      n = 0;
+      return n;
+    }
+    n = std::min(n, (size_t) (t->GetEntries() - local));
+    ev.Tally(n);
+    if (!cached) {
+      Cache(t);
+      cached = true;
+    }
+
+    for (size_t i=0; i<active.size(); i++) {
+      const Event::Binding& b = ev.bindings[active[i]];
+      TBranch* br = t->GetBranch(b.name.c_str());
+      TBranch* count = NULL;
+      if (b.count) {
+        // Array lengths come from the count leaf, so read it alongside
+        count = t->GetBranch(ev.BranchName(b.count).c_str());
+      }
+
+      for (size_t j=0; j<n; j++) {
+        if (count) {
+          count->GetEntry(local + j);
+        }
+        br->GetEntry(local + j);
+        Store(j, active[i]);
+      }
+    }
+
+    for (size_t j=0; j<n; j++) {
+      valid[j] = 0;
+    }
+
+    return n;
+  }
+
+  Event& ev;  //!< The Event whose branch buffers this block mirrors
+  size_t capacity;  //!< Maximum events per block
+  size_t n;  //!< Events in the current block
+  long first;  //!< Entry number of the first event in the block
+  bool compact;  //!< Store particles as floats and PDG code indices
+  std::vector<size_t> active;  //!< Indices of the buffered bindings
+  std::vector<std::vector<char> > columns;  //!< Values, per binding
+  std::vector<std::vector<uint32_t> > offsets;  //!< Per-event offsets, for particle columns
+  std::vector<Event::Features> feat;  //!< Saved Features, per event
+  std::vector<unsigned> valid;  //!< Valid bits of the saved Features
+  std::vector<int> pdgCodes;  //!< PDG codes, by compact index
+  bool cached;  //!< Whether the tree's cache has been set up
+
+protected:
+  /**
+   * Give the Event's tree a TTreeCache for the active branches, holding
+   * about two blocks (judging by t, the first tree read), so the baskets a
+   * block needs are fetched together. A tree that has a cache already
+   * (e.g. the reader of a PrefetchEvent) keeps it.
+   */
+  void Cache(TTree* t) {
+    if (ev.gst->GetCacheSize() > 0) {
+      return;
+    }
+
+    double bytes = 0;
+    for (size_t i=0; i<active.size(); i++) {
+      TBranch* br = t->GetBranch(ev.bindings[active[i]].name.c_str());
+      if (br) {
+        bytes += br->GetZipBytes();
+      }
+    }
+    double perEntry = bytes / std::max(1LL, (long long) t->GetEntries());
+    ev.gst->SetCacheSize(std::max(kMinCacheSize, (long) (2 * capacity * perEntry)));
+    for (size_t i=0; i<active.size(); i++) {
+      ev.gst->AddBranchToCache(ev.bindings[active[i]].name.c_str(), true);
+    }
+    ev.gst->StopCacheLearningPhase();
+  }
+
+  /** Store count particles of b in compact form at dst. */
+  void Narrow(const Event::Binding& b, char* dst, int count) {
+    if (b.size / Event::kNPmax == sizeof(double)) {
+      const double* src = (const double*) b.addr;
+      for (int i=0; i<count; i++) {
+        float v = src[i];
+        memcpy(dst + i * sizeof(float), &v, sizeof(float));
+      }
+    }
+    else {
+      const int* src = (const int*) b.addr;
+      for (int i=0; i<count; i++) {
+        uint16_t code = PdgIndex(src[i]);
+        memcpy(dst + i * sizeof(uint16_t), &code, sizeof(uint16_t));
+      }
+    }
+  }
+
+  /** Expand count compact particles at src into b. */
+  void Widen(const Event::Binding& b, const char* src, size_t count) {
+    if (b.size / Event::kNPmax == sizeof(double)) {
+      double* dst = (double*) b.addr;
+      for (size_t i=0; i<count; i++) {
+        float v;
+        memcpy(&v, src + i * sizeof(float), sizeof(float));
+        dst[i] = v;
+      }
+    }
+    else {
+      int* dst = (int*) b.addr;
+      for (size_t i=0; i<count; i++) {
+        uint16_t code;
+        memcpy(&code, src + i * sizeof(uint16_t), sizeof(uint16_t));
+        dst[i] = pdgCodes[code];
+      }
+    }
+  }
+
+  /** Compact index of a PDG code, adding it to the table if new. */
+  uint16_t PdgIndex(int pdg) {
+    std::map<int, uint16_t>::const_iterator it = pdgIndex.find(pdg);
+    if (it != pdgIndex.end()) {
+      return it->second;
+    }
+    assert(pdgCodes.size() < 65536);
+    uint16_t code = pdgCodes.size();
+    pdgCodes.push_back(pdg);
+    pdgIndex[pdg] = code;
+    return code;
+  }
+
+  std::map<int, uint16_t> pdgIndex;  //!< Compact index of each PDG code
+};
@@ -0,0 +1,367 @@
+/**
+ * Columnar event cache: a directory with one flat binary file per branch,
+ * which is memory-mapped for reading.
+ *
+ * Scalar branches hold one value per event. Per-particle branches hold the
+ * particles of all events back to back, indexed by an offsets column with
+ * nevents+1 entries per particle list (e.g. "ni.off"). The kinematics used
+ * by the histograms (q0, q3, T, cos theta, interaction mode) are computed
+ * once, at conversion time.
+ *
+ * The layout is described in a plain text "meta" file:
+ *
+ *     gstcache 1
+ *     entries <nevents>
+ *     <column> <bytes per value>
+ *     ...
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** A read-only memory-mapped file. */
+class MappedFile {
+public:
+  MappedFile(std::string path) : data(NULL), size(0), ok(false) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+      ok = true;
+      if (st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+          data = (const char*) p;
+          size = st.st_size;
+        }
+        else {
+          ok = false;
+        }
+      }
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data) {
+      munmap((void*) data, size);
+    }
+  }
+
+  const char* data;
+  size_t size;
+  bool ok;
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+};
+
+
+/** Names of the derived kinematics columns. */
+static const char* kCacheKin[5] = {
+  "kin.q0", "kin.q3", "kin.tmu", "kin.ctmu", "kin.intmode"
+};
+
+/** Bytes per value of the derived kinematics columns. */
+static const size_t kCacheKinSize[5] = {
+  sizeof(double), sizeof(double), sizeof(float), sizeof(float), sizeof(int)
+};
+
+
+/**
+ * Convert a sample into a cache directory.
+ *
+ * All branches of ev must be enabled. Returns the number of events written,
+ * or -1 on an I/O error.
+ */
+long WriteCache(Event& ev, std::string dir) {
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    std::cerr << "Cache: cannot create " << dir << std::endl;
+    return -1;
+  }
+
+  std::vector<FILE*> cols;
+  std::map<int*, FILE*> offsets;
+  std::map<int*, uint64_t> noffset;
+  FILE* kin[5] = { NULL, NULL, NULL, NULL, NULL };
+
+  // Close whatever was opened, on an error
+  auto fail = [&](std::string path) {
+    std::cerr << "Cache: cannot write " << path << std::endl;
+    for (size_t i=0; i<cols.size(); i++) {
+      fclose(cols[i]);
+    }
+    for (auto const& o : offsets) {
+      fclose(o.second);
+    }
+    for (int i=0; i<5; i++) {
+      if (kin[i]) {
+        fclose(kin[i]);
+      }
+    }
+    return -1;
+  };
+
+  std::ofstream meta((dir + "/meta").c_str());
+  meta << "gstcache 1" << std::endl;
+  meta << "entries " << ev.GetEntries() << std::endl;
+  if (!meta) {
+    return fail(dir + "/meta");
+  }
+
+  for (size_t i=0; i<ev.bindings.size(); i++) {
+    const Event::Binding& b = ev.bindings[i];
+    size_t size = b.count ? b.size / Event::kNPmax : b.size;
+    std::string path = dir + "/" + b.name + ".col";
+    FILE* col = fopen(path.c_str(), "wb");
+    if (!col) {
+      return fail(path);
+    }
+    cols.push_back(col);
+    meta << b.name << " " << size << std::endl;
+
+    if (b.count && !offsets.count(b.count)) {
+      std::string name = ev.BranchName(b.count) + ".off";
+      FILE* off = fopen((dir + "/" + name).c_str(), "wb");
+      if (!off) {
+        return fail(dir + "/" + name);
+      }
+      offsets[b.count] = off;
+      noffset[b.count] = 0;
+      meta << name << " " << sizeof(uint64_t) << std::endl;
+    }
+  }
+
+  for (int i=0; i<5; i++) {
+    std::string path = dir + "/" + kCacheKin[i] + ".col";
+    kin[i] = fopen(path.c_str(), "wb");
+    if (!kin[i]) {
+      return fail(path);
+    }
+    meta << kCacheKin[i] << " " << kCacheKinSize[i] << std::endl;
+  }
+
+  bool ok = true;
+  for (auto const& o : offsets) {
+    ok = (fwrite(&noffset[o.first], sizeof(uint64_t), 1, o.second) == 1) && ok;
+  }
+
+  long n = ev.GetEntries();
+  for (long i=0; i<n && ok; i++) {
+    ev.GetEntry(i);
+
+    for (size_t j=0; j<ev.bindings.size(); j++) {
+      const Event::Binding& b = ev.bindings[j];
+      if (b.count) {
+        size_t np = *b.count;
+        ok = (fwrite(b.addr, b.size / Event::kNPmax, np, cols[j]) == np) && ok;
+      }
+      else {
+        ok = (fwrite(b.addr, b.size, 1, cols[j]) == 1) && ok;
+      }
+    }
+
+    for (auto const& o : offsets) {
+      noffset[o.first] += *o.first;
+      ok = (fwrite(&noffset[o.first], sizeof(uint64_t), 1, o.second) == 1) && ok;
+    }
+
+    double q0 = ev.q0(), q3 = ev.q3();
+    float tmu = ev.tmu(), ctmu = ev.ctmu();
+    int intmode = ev.intmode();
+    ok = (fwrite(&q0, sizeof(double), 1, kin[0]) == 1 &&
+          fwrite(&q3, sizeof(double), 1, kin[1]) == 1 &&
+          fwrite(&tmu, sizeof(float), 1, kin[2]) == 1 &&
+          fwrite(&ctmu, sizeof(float), 1, kin[3]) == 1 &&
+          fwrite(&intmode, sizeof(int), 1, kin[4]) == 1) && ok;
+  }
+
+  if (!ok) {
+    return fail(dir);
+  }
+
+  ok = meta.good();
+  for (size_t i=0; i<cols.size(); i++) {
+    ok = (fclose(cols[i]) == 0) && ok;
+  }
+  for (auto const& o : offsets) {
+    ok = (fclose(o.second) == 0) && ok;
+  }
+  for (int i=0; i<5; i++) {
+    ok = (fclose(kin[i]) == 0) && ok;
+  }
+
+  return ok ? n : -1;
+}
+
+
+/**
+ * \class CacheEvent
+ * \brief An Event read from a columnar cache.
+ *
+ * GetEntry copies the active columns into the usual Event members and sets
+ * the precomputed kinematics in the Event features, so the Hist classes
+ * fill unchanged.
+ */
+class CacheEvent : public Event {
+public:
+  CacheEvent(std::string _dir) : Event(NULL), dir(_dir), nentries(-1) {
+    std::ifstream meta((dir + "/meta").c_str());
+    std::string tag;
+    int version = 0;
+    meta >> tag >> version >> tag >> nentries;
+    if (!meta || version != 1) {
+      std::cerr << "Cache: bad meta file in " << dir << std::endl;
+      nentries = -1;
+      return;
+    }
+
+    std::map<std::string, size_t> sizes;
+    std::string name;
+    size_t size;
+    while (meta >> name >> size) {
+      sizes[name] = size;
+    }
+
+    for (size_t i=0; i<bindings.size(); i++) {
+      const Binding& b = bindings[i];
+      size_t expect = b.count ? b.size / kNPmax : b.size;
+      if (sizes[b.name] != expect) {
+        std::cerr << "Cache: missing or mismatched column " << b.name << std::endl;
+        nentries = -1;
+        return;
+      }
+
+      // Particle columns hold off[nentries] values, and no event may have
+      // more particles than the Event arrays
+      const uint64_t* off = NULL;
+      size_t need = nentries * b.size;
+      if (b.count) {
+        std::string offname = BranchName(b.count) + ".off";
+        off = (const uint64_t*) Map(offname, (nentries + 1) * sizeof(uint64_t));
+        if (!IsOpen()) {
+          return;
+        }
+        if (!checked.count(offname)) {
+          for (long j=0; j<nentries; j++) {
+            if (off[j+1] < off[j] || off[j+1] - off[j] > (uint64_t) kNPmax) {
+              std::cerr << "Cache: bad offsets in " << dir << "/" << offname << std::endl;
+              nentries = -1;
+              return;
+            }
+          }
+          checked.insert(offname);
+        }
+        need = off[nentries] * expect;
+      }
+      columns.push_back(Map(b.name + ".col", need));
+      if (!IsOpen()) {
+        return;
+      }
+      columnOffsets.push_back(off);
+      active.push_back(i);
+    }
+
+    for (int i=0; i<5; i++) {
+      if (sizes[kCacheKin[i]] != kCacheKinSize[i]) {
+        std::cerr << "Cache: missing or mismatched column " << kCacheKin[i] << std::endl;
+        nentries = -1;
+        return;
+      }
+      kinColumns[i] = Map(std::string(kCacheKin[i]) + ".col",
+                          nentries * kCacheKinSize[i]);
+    }
+  }
+
+  ~CacheEvent() {
+    for (auto const& f : files) {
+      delete f.second;
+    }
+  }
+
+  bool IsOpen() { return nentries >= 0; }
+
+  long GetEntries() { return nentries; }
+
+  void GetEntry(long i) {
+    for (size_t j=0; j<active.size(); j++) {
+      const Binding& b = bindings[active[j]];
+      const char* col = columns[active[j]];
+
+      if (b.count) {
+        const uint64_t* off = columnOffsets[active[j]];
+        size_t size = b.size / kNPmax;
+        if (off[i+1] > off[i]) {
+          memcpy(b.addr, col + off[i] * size, (off[i+1] - off[i]) * size);
+        }
+      }
+      else {
+        memcpy(b.addr, col + i * b.size, b.size);
+      }
+    }
+
+    feat.q0 = ((const double*) kinColumns[0])[i];
+    feat.q3 = ((const double*) kinColumns[1])[i];
+    feat.tmu = ((const float*) kinColumns[2])[i];
+    feat.ctmu = ((const float*) kinColumns[3])[i];
+    feat.intmode = ((const int*) kinColumns[4])[i];
+    valid = kQ0 | kQ3 | kTmu | kCtmu | kMode;
+    entry = i;
+  }
+
+  /** Copy only the given columns (and the particle counts they need). */
+  void SetActive(const std::set<std::string>& names) {
+    if (names.count("*")) {
+      return;
+    }
+
+    std::set<std::string> all(names);
+    for (size_t i=0; i<bindings.size(); i++) {
+      if (bindings[i].count && names.count(bindings[i].name)) {
+        all.insert(BranchName(bindings[i].count));
+      }
+    }
+
+    active.clear();
+    for (size_t i=0; i<bindings.size(); i++) {
+      if (all.count(bindings[i].name)) {
+        active.push_back(i);
+      }
+    }
+  }
+
+protected:
+  /** Map a column file (once), checking it holds at least size bytes. */
+  const char* Map(std::string name, size_t size) {
+    if (!files.count(name)) {
+      files[name] = new MappedFile(dir + "/" + name);
+    }
+
+    MappedFile* f = files[name];
+    if (!f->ok || f->size < size) {
+      std::cerr << "Cache: cannot map " << dir << "/" << name << std::endl;
+      nentries = -1;
+    }
+    return f->data;
+  }
+
+  std::string dir;
+  long nentries;
+  std::map<std::string, MappedFile*> files;
+  std::set<std::string> checked;  //!< Offsets files checked
+  std::vector<const char*> columns;
+  std::vector<const uint64_t*> columnOffsets;
+  std::vector<size_t> active;
+  const char* kinColumns[5];
+};
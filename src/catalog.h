@@ -0,0 +1,204 @@
+/**
+ * A catalog of input files (a cached sample manifest): the entry count and
+ * compressed branch sizes of each file, found by opening the files in
+ * parallel once, and saved so later runs needn't open anything to start.
+ *
+ * Files are identified by path, size and modification time (as in the
+ * Ledger), so changed and new files are rescanned, and files that can't
+ * be read are remembered too. The catalog is a text file:
+ *
+ *     gstcatalog 1
+ *     file <path> <size> <mtime> <entries>
+ *     branch <name> <compressed bytes> <uncompressed bytes>
+ *     ...
+ *     bad <path> <size> <mtime> <reason>
+ *
+ * where the branch lines belong to the file above them.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TTree.h>
+
+/** Catalog entry for one file */
+struct FileInfo {
+  FileInfo() : entries(-1) {}
+
+  FileStamp stamp;
+  long entries;  //!< Entries in the gst tree, or -1 if the file is bad
+  std::string error;  //!< Why the file is bad
+  std::map<std::string, std::pair<double, double> > branches;  //!< Compressed, uncompressed bytes
+
+  /** Compressed bytes of all branches. */
+  double Bytes() const {
+    double bytes = 0;
+    for (auto const& b : branches) {
+      bytes += b.second.first;
+    }
+    return bytes;
+  }
+};
+
+
+/**
+ * \class Catalog
+ * \brief Entry counts and sizes of input files, by path.
+ */
+class Catalog {
+public:
+  Catalog() : changed(false) {}
+
+  /** Read a catalog; a missing file is an empty catalog. */
+  bool Read(std::string path) {
+    std::ifstream f(path.c_str());
+    if (!f) {
+      return true;
+    }
+
+    std::string line, key, name;
+    int version = 0;
+    if (!std::getline(f, line) || sscanf(line.c_str(), "gstcatalog %d", &version) != 1 ||
+        version != 1) {
+      std::cerr << "Catalog: " << path << " is not a catalog" << std::endl;
+      return false;
+    }
+
+    FileInfo* cur = NULL;
+    while (std::getline(f, line)) {
+      std::istringstream ss(line);
+      ss >> key;
+      if (key == "file" || key == "bad") {
+        FileInfo info;
+        ss >> name >> info.stamp.size >> info.stamp.mtime;
+        if (key == "file") {
+          ss >> info.entries;
+        }
+        else {
+          std::getline(ss >> std::ws, info.error);
+        }
+        cur = &(files[name] = info);
+      }
+      else if (key == "branch" && cur) {
+        std::pair<double, double> b;
+        ss >> name >> b.first >> b.second;
+        cur->branches[name] = b;
+      }
+    }
+
+    return true;
+  }
+
+  /** Write the catalog. Returns false on an I/O error. */
+  bool Write(std::string path) const {
+    std::ofstream f(path.c_str());
+    f << "gstcatalog 1" << std::endl;
+    for (auto const& file : files) {
+      const FileInfo& info = file.second;
+      if (info.entries < 0) {
+        f << "bad " << file.first << " " << info.stamp.size << " "
+          << info.stamp.mtime << " " << info.error << std::endl;
+        continue;
+      }
+
+      f << "file " << file.first << " " << info.stamp.size << " "
+        << info.stamp.mtime << " " << info.entries << std::endl;
+      for (auto const& b : info.branches) {
+        f << "branch " << b.first << " " << b.second.first << " "
+          << b.second.second << std::endl;
+      }
+    }
+    return f.good();
+  }
+
+  /** Open a file and read its metadata. */
+  static FileInfo Scan(std::string path) {
+    FileInfo info;
+    info.stamp = Stamp(path);
+
+    TFile* f = TFile::Open(path.c_str());
+    TTree* t = NULL;
+    if (!f || f->IsZombie()) {
+      info.error = "unreadable";
+    }
+    else if (f->TestBit(TFile::kRecovered)) {
+      info.error = "not closed properly";
+    }
+    else if (!(t = dynamic_cast<TTree*>(f->Get("gst")))) {
+      info.error = "no gst tree";
+    }
+    else {
+      info.entries = t->GetEntries();
+      TObjArray* bl = t->GetListOfBranches();
+      for (int i=0; i<bl->GetEntriesFast(); i++) {
+        TBranch* b = (TBranch*) bl->UncheckedAt(i);
+        info.branches[b->GetName()] = std::make_pair(1.0 * b->GetZipBytes(),
+                                                     1.0 * b->GetTotBytes());
+      }
+    }
+
+    delete f;
+    return info;
+  }
+
+  /**
+   * Scan the files that are new or have changed since they were last
+   * scanned, njobs at a time. Returns the number scanned.
+   */
+  size_t Update(const std::vector<TString>& paths, int njobs) {
+    std::vector<std::string> todo;
+    for (size_t i=0; i<paths.size(); i++) {
+      std::string path = paths[i].Data();
+      std::map<std::string, FileInfo>::const_iterator it = files.find(path);
+      if (it == files.end() || !(it->second.stamp == Stamp(path))) {
+        todo.push_back(path);
+      }
+    }
+    if (todo.empty()) {
+      return 0;
+    }
+
+    ROOT::EnableThreadSafety();
+    std::vector<FileInfo> found(todo.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+      for (size_t i=next++; i<todo.size(); i=next++) {
+        found[i] = Scan(todo[i]);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i=0; i<njobs; i++) {
+      threads.push_back(std::thread(worker));
+    }
+    for (size_t i=0; i<threads.size(); i++) {
+      threads[i].join();
+    }
+
+    for (size_t i=0; i<todo.size(); i++) {
+      files[todo[i]] = found[i];
+    }
+    changed = true;
+    return todo.size();
+  }
+
+  /** The entry for a file, or NULL if it isn't in the catalog. */
+  const FileInfo* Find(std::string path) const {
+    std::map<std::string, FileInfo>::const_iterator it = files.find(path);
+    return (it != files.end() ? &it->second : NULL);
+  }
+
+  std::map<std::string, FileInfo> files;  //!< Files, by path
+  bool changed;  //!< Files were scanned since the catalog was read
+};
@@ -1,7 +1,17 @@
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <TBranch.h>
 #include <TChain.h>
 #include <TH1D.h>
 #include <TH2D.h>
 #include <TLorentzVector.h>
+#include <TObjArray.h>
 #include <TString.h>
 #include <TVector3.h>
 
@@ -13,68 +23,117 @@
  */
 class Event {
 public:
-  Event(TTree* _t) : gst(_t) {
-    gst->SetBranchAddress("neu", &neu);
-    gst->SetBranchAddress("tgt", &tgt);
-    gst->SetBranchAddress("nuance_code", &nuance_code);
-    gst->SetBranchAddress("qel", &qel);
-    gst->SetBranchAddress("res", &res);
-    gst->SetBranchAddress("dis", &dis);
-    gst->SetBranchAddress("coh", &coh);
-    gst->SetBranchAddress("dfr", &dfr);
-    gst->SetBranchAddress("imd", &imd);
-    gst->SetBranchAddress("nuel", &nuel);
-    gst->SetBranchAddress("cc", &cc);
-    gst->SetBranchAddress("nc", &nc);
-    gst->SetBranchAddress("pxv", &pxv);
-    gst->SetBranchAddress("pyv", &pyv);
-    gst->SetBranchAddress("pzv", &pzv);
-    gst->SetBranchAddress("pxl", &pxl);
-    gst->SetBranchAddress("pyl", &pyl);
-    gst->SetBranchAddress("pzl", &pzl);
-    gst->SetBranchAddress("x", &x);
-    gst->SetBranchAddress("y", &y);
-    gst->SetBranchAddress("t", &t);
-    gst->SetBranchAddress("Q2", &q2);
-    gst->SetBranchAddress("W", &w);
-    gst->SetBranchAddress("Ev", &enu);
-    gst->SetBranchAddress("El", &elep);
-
-    gst->SetBranchAddress("ni", &ni);
-    gst->SetBranchAddress("pdgi", &pdgi);
-    gst->SetBranchAddress("Ei", &ei);
-    gst->SetBranchAddress("pxi", &pxi);
-    gst->SetBranchAddress("pyi", &pyi);
-    gst->SetBranchAddress("pzi", &pzi);
-    gst->SetBranchAddress("nip", &nip);
-    gst->SetBranchAddress("nin", &nin);
-    gst->SetBranchAddress("nipip", &nipip);
-    gst->SetBranchAddress("nipim", &nipim);
-    gst->SetBranchAddress("nipi0", &nipi0);
-    gst->SetBranchAddress("nikp", &nikp);
-    gst->SetBranchAddress("nikm", &nikm);
-    gst->SetBranchAddress("nik0", &nik0);
-    gst->SetBranchAddress("niem", &niem);
-
-    gst->SetBranchAddress("nf", &nf);
-    gst->SetBranchAddress("pdgf", &pdgf);
-    gst->SetBranchAddress("Ef", &ef);
-    gst->SetBranchAddress("pxf", &pxf);
-    gst->SetBranchAddress("pyf", &pyf);
-    gst->SetBranchAddress("pzf", &pzf);
-    gst->SetBranchAddress("nfp", &nfp);
-    gst->SetBranchAddress("nfn", &nfn);
-    gst->SetBranchAddress("nfpip", &nfpip);
-    gst->SetBranchAddress("nfpim", &nfpim);
-    gst->SetBranchAddress("nfpi0", &nfpi0);
-    gst->SetBranchAddress("nfkp", &nfkp);
-    gst->SetBranchAddress("nfkm", &nfkm);
-    gst->SetBranchAddress("nfk0", &nfk0);
-    gst->SetBranchAddress("nfem", &nfem);
-  }
-
-  /// Convenience getters
-  int intmode() {
+  Event(TTree* _t) : valid(0), gst(_t), entry(-1), zipRead(0), zipTotal(0),
+                     tree(-1), treeRead(0), zipActive(0), zipAll(0) {
+    // Start from zero, so buffers of branches that are never read are sane
+    neu = tgt = nuance_code = 0;
+    qel = res = dis = coh = dfr = imd = nuel = cc = nc = false;
+    pxv = pyv = pzv = pxl = pyl = pzl = x = y = t = q2 = w = enu = elep = 0;
+    ni = nip = nin = nipip = nipim = nipi0 = nikp = nikm = nik0 = niem = 0;
+    nf = nfp = nfn = nfpip = nfpim = nfpi0 = nfkp = nfkm = nfk0 = nfem = 0;
+
+    Bind("neu", &neu);
+    Bind("tgt", &tgt);
+    Bind("nuance_code", &nuance_code);
+    Bind("qel", &qel);
+    Bind("res", &res);
+    Bind("dis", &dis);
+    Bind("coh", &coh);
+    Bind("dfr", &dfr);
+    Bind("imd", &imd);
+    Bind("nuel", &nuel);
+    Bind("cc", &cc);
+    Bind("nc", &nc);
+    Bind("pxv", &pxv);
+    Bind("pyv", &pyv);
+    Bind("pzv", &pzv);
+    Bind("pxl", &pxl);
+    Bind("pyl", &pyl);
+    Bind("pzl", &pzl);
+    Bind("x", &x);
+    Bind("y", &y);
+    Bind("t", &t);
+    Bind("Q2", &q2);
+    Bind("W", &w);
+    Bind("Ev", &enu);
+    Bind("El", &elep);
+
+    Bind("ni", &ni);
+    Bind("pdgi", &pdgi, &ni);
+    Bind("Ei", &ei, &ni);
+    Bind("pxi", &pxi, &ni);
+    Bind("pyi", &pyi, &ni);
+    Bind("pzi", &pzi, &ni);
+    Bind("nip", &nip);
+    Bind("nin", &nin);
+    Bind("nipip", &nipip);
+    Bind("nipim", &nipim);
+    Bind("nipi0", &nipi0);
+    Bind("nikp", &nikp);
+    Bind("nikm", &nikm);
+    Bind("nik0", &nik0);
+    Bind("niem", &niem);
+
+    Bind("nf", &nf);
+    Bind("pdgf", &pdgf, &nf);
+    Bind("Ef", &ef, &nf);
+    Bind("pxf", &pxf, &nf);
+    Bind("pyf", &pyf, &nf);
+    Bind("pzf", &pzf, &nf);
+    Bind("nfp", &nfp);
+    Bind("nfn", &nfn);
+    Bind("nfpip", &nfpip);
+    Bind("nfpim", &nfpim);
+    Bind("nfpi0", &nfpi0);
+    Bind("nfkp", &nfkp);
+    Bind("nfkm", &nfkm);
+    Bind("nfk0", &nfk0);
+    Bind("nfem", &nfem);
+  }
+
+  virtual ~Event() {}
+
+  static const unsigned kNPke = 2;  //!< Number of proton KEs kept
+
+  /**
+   * Derived quantities for the current entry.
+   *
+   * Each group is filled on first use after GetEntry (see the getters), so
+   * selections and histograms can share them without recomputing, and
+   * without allocating.
+   */
+  struct Features {
+    int intmode;
+    double lmass;
+    double q0, q3;
+    float tmu, ctmu;
+
+    // Post-FSI: protons with T > 60 MeV, pi0s, and pi+ (the charged pion
+    // count in the 1l1trk selection has only ever counted pdg 211)
+    unsigned nfp60, nfpi0, nfpiq;
+
+    // Pre-FSI protons: count, the first kNPke kinetic energies in GST
+    // order, and the leading kinetic energy
+    unsigned nip;
+    double pke[kNPke];
+    double leadpke;
+  };
+
+  /// Bits in valid for each group of Features
+  enum {
+    kMode = 1 << 0, kQ0 = 1 << 1, kQ3 = 1 << 2, kLmass = 1 << 3,
+    kTmu = 1 << 4, kCtmu = 1 << 5, kPostFSI = 1 << 6, kPreFSI = 1 << 7
+  };
+
+  Features feat;
+  unsigned valid;
+
+  /**
+   * Kinematics from branch values, shared by the getters below and the
+   * batch kernels (see kernels.h), so both give bit-identical results.
+   */
+  static int Mode(bool cc, bool nc, bool qel, bool res, bool dis, bool coh,
+                  int nuance_code) {
     int imode = 10;
     if      (cc && qel) imode = 0;
     else if (cc && res) imode = 2;
@@ -86,21 +145,22 @@ public:
     else if (nc && dis) imode = 8;
     else if (nc && coh) imode = 9;
     else if (nc && nuance_code == 0) imode = 6;
-
     return imode;
   }
 
-  double q0() { return enu - elep; }
-
-  double q3() {
-    return (TVector3(pxv, pyv, pzv) - TVector3(pxl, pyl, pzl)).Mag();
+  /** Magnitude of (x, y, z), as TVector3::Mag. */
+  static double Mag(double x, double y, double z) {
+    return sqrt(x * x + y * y + z * z);
   }
 
-  TLorentzVector pnu() { return TLorentzVector(pxv, pyv, pzv, enu); }
-
-  TLorentzVector plep() { return TLorentzVector(pxl, pyl, pzl, elep); }
+  /** Cosine of the polar angle of (x, y, z), as TVector3::CosTheta. */
+  static double CosTheta(double x, double y, double z) {
+    double ptot = Mag(x, y, z);
+    return (ptot == 0.0 ? 1.0 : z / ptot);
+  }
 
-  double lmass() {
+  /** Charged lepton mass for a neutrino flavor (-9999 if unknown). */
+  static float LeptonMass(bool cc, bool nc, int neu) {
     float lm = -9999;
 
     if (cc && abs(neu) == 12) {
@@ -119,55 +179,271 @@ public:
     return lm;
   }
 
-  float tmu() { return elep - lmass(); }
+  /** The lepton kinetic energy cut of the topology selections. */
+  static bool PassTmu(int neu, float tmu) {
+    return ((abs(neu) == 12 && tmu > 0.030) ||
+            (abs(neu) == 14 && tmu > 0.060));
+  }
+
+  /// Convenience getters, computed at most once per entry (see Features)
+  int intmode() {
+    if (!(valid & kMode)) {
+      feat.intmode = Mode(cc, nc, qel, res, dis, coh, nuance_code);
+      valid |= kMode;
+    }
+
+    return feat.intmode;
+  }
+
+  double q0() {
+    if (!(valid & kQ0)) {
+      feat.q0 = enu - elep;
+      valid |= kQ0;
+    }
+
+    return feat.q0;
+  }
+
+  double q3() {
+    if (!(valid & kQ3)) {
+      feat.q3 = Mag(pxv - pxl, pyv - pyl, pzv - pzl);
+      valid |= kQ3;
+    }
+
+    return feat.q3;
+  }
+
+  TLorentzVector pnu() { return TLorentzVector(pxv, pyv, pzv, enu); }
+
+  TLorentzVector plep() { return TLorentzVector(pxl, pyl, pzl, elep); }
+
+  double lmass() {
+    if (!(valid & kLmass)) {
+      feat.lmass = LeptonMass(cc, nc, neu);
+      valid |= kLmass;
+    }
+
+    return feat.lmass;
+  }
+
+  float tmu() {
+    if (!(valid & kTmu)) {
+      feat.tmu = elep - lmass();
+      valid |= kTmu;
+    }
+
+    return feat.tmu;
+  }
+
+  float ctmu() {
+    if (!(valid & kCtmu)) {
+      feat.ctmu = CosTheta(pxl, pyl, pzl);
+      valid |= kCtmu;
+    }
+
+    return feat.ctmu;
+  }
+
+  /** Post-FSI particle counts used by the topology selections. */
+  const Features& PostFSI() {
+    if (!(valid & kPostFSI)) {
+      feat.nfp60 = feat.nfpi0 = feat.nfpiq = 0;
+      for (int ii=0; ii<nf; ii++) {
+        if (pdgf[ii] == 2212 && ef[ii] - 0.938272 > 0.060) feat.nfp60++;
+        if (pdgf[ii] == 111) feat.nfpi0++;
+        if (pdgf[ii] == 211) feat.nfpiq++;
+      }
+      valid |= kPostFSI;
+    }
+
+    return feat;
+  }
+
+  /** Pre-FSI proton kinetic energies. */
+  const Features& PreFSI() {
+    if (!(valid & kPreFSI)) {
+      feat.nip = 0;
+      feat.leadpke = 0;
+      for (int ii=0; ii<ni; ii++) {
+        if (pdgi[ii] == 2212) {
+          double ke = ei[ii] - 0.938272;
+          if (feat.nip < kNPke) feat.pke[feat.nip] = ke;
+          if (feat.nip == 0 || ke > feat.leadpke) feat.leadpke = ke;
+          feat.nip++;
+        }
+      }
+      valid |= kPreFSI;
+    }
+
+    return feat;
+  }
 
-  float ctmu() { return plep().Vect().CosTheta(); }
+  /// Branches read by the convenience getters
+  static const char* intmodeBranches() { return "cc nc qel res dis coh nuance_code"; }
+  static const char* q0Branches() { return "Ev El"; }
+  static const char* q3Branches() { return "pxv pyv pzv pxl pyl pzl"; }
+  static const char* tmuBranches() { return "cc nc neu El"; }
+  static const char* ctmuBranches() { return "pxl pyl pzl"; }
 
   /// Event type selections
   typedef bool (*EventType)(Event& e);
 
+  /** Add the branches read by a selection to b. */
+  static void Branches(EventType sel, std::set<std::string>& b) {
+    if (sel == isAny) {
+      return;
+    }
+    else if (sel == isCC || sel == isNC) {
+      Need(b, "cc nc");
+    }
+    else if (sel == is1l1p0pi0 || sel == is1l1trk0pi0) {
+      Need(b, "nf pdgf Ef");
+      Need(b, tmuBranches());
+    }
+    else {
+      for (int i=0; i<kNModes; i++) {
+        if (sel == ModeSelection(i)) {
+          Need(b, intmodeBranches());
+          return;
+        }
+      }
+      Need(b, "*");  // Unknown selection, read everything
+    }
+  }
+
+  /// Interaction modes, as returned by intmode()
+  static const int kNModes = 11;
+
+  static const char* ModeName(int mode) {
+    static const char* names[kNModes] = {
+      "CCQE", "CCMEC", "CCRes", "CCDIS", "CCCoh",
+      "NCEL", "NCMEC", "NCRes", "NCDIS", "NCCoh",
+      "Other"
+    };
+    return names[mode];
+  }
+
+  /** The selection of events with a given interaction mode. */
+  static EventType ModeSelection(int mode) {
+    static const EventType sel[kNModes] = {
+      isCCQE, isCCMEC, isMode<2>, isMode<3>, isMode<4>, isMode<5>,
+      isMode<6>, isMode<7>, isMode<8>, isMode<9>, isMode<10>
+    };
+    return sel[mode];
+  }
+
   static bool isAny(Event& e) { return true; }
 
   static bool isCCQE(Event& e) { return e.intmode() == 0; }
 
   static bool isCCMEC(Event& e) { return e.intmode() == 1; }
 
-  static bool is1l1p0pi0(Event& e) {
-    unsigned np = 0;
-    unsigned npi0 = 0;
+  template<int M>
+  static bool isMode(Event& e) { return e.intmode() == M; }
 
-    for (int ii=0; ii<e.nf; ii++) {
-      if (e.pdgf[ii] == 2212 && e.ef[ii] - 0.938272 > 0.060) np++;
-      if (e.pdgf[ii] == 111) npi0++;
-    }
+  static bool isCC(Event& e) { return e.cc; }
 
-    return (e.cc && np == 1 && npi0 == 0 &&
-            ((abs(e.neu) == 12 && e.tmu() > 0.030) ||
-             (abs(e.neu) == 14 && e.tmu() > 0.060)));
+  static bool isNC(Event& e) { return e.nc; }
+
+  static bool is1l1p0pi0(Event& e) {
+    const Features& f = e.PostFSI();
+
+    return (e.cc && f.nfp60 == 1 && f.nfpi0 == 0 && PassTmu(e.neu, e.tmu()));
   }
 
   static bool is1l1trk0pi0(Event& e) {
-    unsigned np = 0;
-    unsigned npi0 = 0;
-    unsigned npiq = 0;
-
-    for (int ii=0; ii<e.nf; ii++) {
-      if (e.pdgf[ii] == 2212 && e.ef[ii] - 0.938272 > 0.060) np++;
-      if (e.pdgf[ii] == 111) npi0++;
-      if (abs(e.pdgf[ii] == 211)) npiq++;
-    }
+    const Features& f = e.PostFSI();
 
-    return (e.cc && np + npiq == 1 &&
-            ((abs(e.neu) == 12 && e.tmu() > 0.030) ||
-             (abs(e.neu) == 14 && e.tmu() > 0.060)));
+    return (e.cc && f.nfp60 + f.nfpiq == 1 && PassTmu(e.neu, e.tmu()));
   }
 
   /// Tree 
   TTree* gst;
+  long entry;  //!< Entry number of the current event
   static const int kNPmax = 250;  // Matches GENIE gntpc
 
-  long GetEntries() { return gst->GetEntries(); }
-  void GetEntry(long i) { gst->GetEntry(i); }
+  virtual long GetEntries() { return gst->GetEntries(); }
+
+  virtual void GetEntry(long i) {
+    gst->GetEntry(i);
+    entry = i;
+    valid = 0;
+    Tally(1);
+  }
+
+  /** Count the compressed bytes for n entries of the current tree. */
+  void Tally(long n) {
+    if (gst->GetTreeNumber() != tree) {
+      CountBytes();
+    }
+    zipRead += n * zipActive;
+    zipTotal += n * zipAll;
+    treeRead += n;
+  }
+
+  /**
+   * Bytes read so far per active branch, compressed and uncompressed.
+   *
+   * Estimated from the average size per entry of each branch in each tree.
+   */
+  const std::map<std::string, std::pair<double, double> >& BranchBytes() {
+    FoldBytes();
+    return branchBytes;
+  }
+
+  /** Add a space-separated list of branch names to b. */
+  static void Need(std::set<std::string>& b, const std::string& names) {
+    std::istringstream ss(names);
+    std::string name;
+    while (ss >> name) {
+      b.insert(name);
+    }
+  }
+
+  /** Name of the branch bound to a member of this Event. */
+  std::string BranchName(const void* addr) const {
+    std::map<const void*, std::string>::const_iterator it = branches.find(addr);
+    return (it != branches.end() ? it->second : "*");
+  }
+
+  /**
+   * Make branches in t for the bound members named in names (all, with
+   * "*"), so t->Fill() writes this Event's values in the GST layout.
+   */
+  void MakeBranches(TTree* t, const std::set<std::string>& names) {
+    for (size_t i=0; i<bindings.size(); i++) {
+      const Binding& b = bindings[i];
+      if (!names.count("*") && !names.count(b.name)) {
+        continue;
+      }
+
+      // The leaf type comes from the size
+      size_t size = b.count ? b.size / kNPmax : b.size;
+      const char* type = (size == 1 ? "O" : size == 4 ? "I" : "D");
+      TString leaf = b.name.c_str();
+      if (b.count) {
+        leaf += TString("[") + BranchName(b.count).c_str() + "]";
+      }
+      leaf += TString("/") + type;
+      t->Branch(b.name.c_str(), b.addr, leaf);
+    }
+  }
+
+  /** Read only the given branches; the rest are disabled. */
+  virtual void SetActive(const std::set<std::string>& names) {
+    if (names.count("*")) {
+      return;
+    }
+
+    gst->SetBranchStatus("*", false);
+    for (auto const& name : names) {
+      gst->SetBranchStatus(name.c_str(), true);
+    }
+    tree = -1;
+  }
+
+  /// Compressed bytes for the entries read, for the active and all branches
+  double zipRead, zipTotal;
 
   // General
   int neu, tgt, nuance_code;
@@ -183,6 +459,73 @@ public:
   int nf, nfp, nfn, nfpip, nfpim, nfpi0, nfkp, nfkm, nfk0, nfem;
   int pdgf[kNPmax];
   double ef[kNPmax], pxf[kNPmax], pyf[kNPmax], pzf[kNPmax];
+
+  /// A branch bound to a member of this Event
+  struct Binding {
+    std::string name;
+    void* addr;
+    size_t size;  //!< Size of the member in bytes
+    int* count;  //!< Array length, for per-particle branches
+  };
+
+  std::vector<Binding> bindings;
+
+protected:
+  /** Bind a branch to a member; with no tree, just record the binding. */
+  template<class T>
+  void Bind(const char* name, T* addr, int* count=NULL) {
+    if (gst) {
+      gst->SetBranchAddress(name, addr);
+    }
+
+    Binding b = { name, addr, sizeof(T), count };
+    bindings.push_back(b);
+    branches[addr] = name;
+  }
+
+  /** Add the entries read from the current tree to branchBytes. */
+  void FoldBytes() {
+    for (size_t i=0; i<activeBytes.size(); i++) {
+      std::pair<double, double>& b = branchBytes[activeBytes[i].first];
+      b.first += treeRead * activeBytes[i].second.first;
+      b.second += treeRead * activeBytes[i].second.second;
+    }
+    treeRead = 0;
+  }
+
+  /** Per-entry compressed size of the current tree's branches. */
+  void CountBytes() {
+    FoldBytes();
+    activeBytes.clear();
+    tree = gst->GetTreeNumber();
+    zipActive = zipAll = 0;
+
+    TTree* cur = gst->GetTree();
+    if (!cur || cur->GetEntries() == 0) {
+      return;
+    }
+
+    TObjArray* bl = cur->GetListOfBranches();
+    for (int i=0; i<bl->GetEntriesFast(); i++) {
+      TBranch* b = (TBranch*) bl->UncheckedAt(i);
+      double z = 1.0 * b->GetZipBytes() / cur->GetEntries();
+      zipAll += z;
+      if (gst->GetBranchStatus(b->GetName())) {
+        zipActive += z;
+        double tot = 1.0 * b->GetTotBytes() / cur->GetEntries();
+        activeBytes.push_back(std::make_pair(b->GetName(), std::make_pair(z, tot)));
+      }
+    }
+  }
+
+  std::map<const void*, std::string> branches;
+  int tree;
+  long treeRead;  //!< Entries read from the current tree
+  double zipActive, zipAll;
+
+  /// Per-entry compressed and uncompressed bytes of the active branches
+  std::vector<std::pair<std::string, std::pair<double, double> > > activeBytes;
+  std::map<std::string, std::pair<double, double> > branchBytes;
 };
 
 
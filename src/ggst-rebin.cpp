@@ -0,0 +1,237 @@
+/**
+ * Rebin histograms from the fine sparse copies written by ggst --fine.
+ *
+ * Each histogram matching a --bins pattern that has a fine copy
+ * (<name>_fine, see sparse.h) is replaced by one with the number of bins
+ * given over the same range, derived from the fine cells. Each new bin is
+ * the sum of whole fine cells, so the number of bins must divide the
+ * number of fine cells along each axis; with the number of bins ggst
+ * used, the result is the histogram as ggst filled it. The range is
+ * unchanged, so the statistics (means, RMSs) are taken from the histogram
+ * replaced, which keeps them as filled; without it, they are computed from
+ * the bin centres.
+ *
+ * Files are updated in place, --jobs at a time; run ggst-render afterwards
+ * for the canvases and PDFs.
+ *
+ * Usage: ggst-rebin [--jobs N] --bins HIST NX [NY] ... <config>_<gen>.root ...
+ *
+ * where HIST is a histogram name or a shell pattern (e.g. "h_*_q0q3"), and
+ * NY defaults to NX for 2D histograms.
+ */
+
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fnmatch.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <TClass.h>
+#include <TError.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <THnSparse.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TROOT.h>
+#include <TString.h>
+
+/** A --bins request: histograms matching a pattern, and their bins. */
+struct Binning {
+  std::string pattern;
+  int nx, ny;  //!< Bins along x and y (0: as x)
+};
+
+
+/** The bin holding fine bin i, grouping g of n fine bins per bin. */
+int group(int i, int n, int g) {
+  if (i == 0) {
+    return 0;
+  }
+  return (i > n ? n / g + 1 : (i - 1) / g + 1);
+}
+
+
+/**
+ * A histogram with nx (by ny) bins from the fine cells of s, or NULL if
+ * the bins don't divide the fine cells.
+ */
+TH1* rebin(const THnBase* s, TString name, int nx, int ny) {
+  int ndim = s->GetNdimensions();
+  const TAxis* ax = s->GetAxis(0);
+  const TAxis* ay = (ndim > 1 ? s->GetAxis(1) : NULL);
+  int fx = ax->GetNbins();
+  int fy = (ay ? ay->GetNbins() : 1);
+  ny = (ny > 0 ? ny : nx);
+  if (ndim > 2 || nx < 1 || fx % nx != 0 || (ay && fy % ny != 0)) {
+    return NULL;
+  }
+
+  TH1* h;
+  if (ay) {
+    h = new TH2D(name, s->GetTitle(), nx, ax->GetXmin(), ax->GetXmax(),
+                 ny, ay->GetXmin(), ay->GetXmax());
+  }
+  else {
+    h = new TH1D(name, s->GetTitle(), nx, ax->GetXmin(), ax->GetXmax());
+  }
+  h->GetXaxis()->SetTitle(ax->GetTitle());
+  if (ay) {
+    h->GetYaxis()->SetTitle(ay->GetTitle());
+  }
+
+  int idx[2] = { 0, 0 };
+  for (Long64_t i=0; i<s->GetNbins(); i++) {
+    double c = s->GetBinContent(i, idx);
+    int bx = group(idx[0], fx, fx / nx);
+    int by = (ay ? group(idx[1], fy, fy / ny) : 0);
+    int bin = h->GetBin(bx, by);
+    h->SetBinContent(bin, h->GetBinContent(bin) + c);
+  }
+
+  h->SetEntries(s->GetEntries());
+  return h;
+}
+
+
+/** Rebin the matching histograms in one file. Returns false on error. */
+bool rebin_file(TString path, const std::vector<Binning>& binnings) {
+  TFile* f = TFile::Open(path, "update");
+  if (!f || f->IsZombie()) {
+    std::cerr << "Cannot open " << path << std::endl;
+    delete f;
+    return false;
+  }
+
+  // Collect the fine copies first, since writing changes the keys
+  std::vector<TString> names;
+  TIter next(f->GetListOfKeys());
+  TKey* key;
+  while ((key = (TKey*) next())) {
+    TClass* cls = TClass::GetClass(key->GetClassName());
+    TString name = key->GetName();
+    if (cls && cls->InheritsFrom("THnBase") && name.EndsWith("_fine")) {
+      names.push_back(name);
+    }
+  }
+
+  bool ok = true;
+  for (size_t i=0; i<names.size(); i++) {
+    TString name = names[i](0, names[i].Length() - 5);
+    const Binning* b = NULL;
+    for (size_t j=0; j<binnings.size() && !b; j++) {
+      if (fnmatch(binnings[j].pattern.c_str(), name.Data(), 0) == 0) {
+        b = &binnings[j];
+      }
+    }
+    if (!b) {
+      continue;
+    }
+
+    THnBase* s = (THnBase*) f->Get(names[i]);
+    TH1* old = dynamic_cast<TH1*>(f->Get(name));
+    TH1* h = rebin(s, name, b->nx, b->ny);
+    if (!h) {
+      std::cerr << path << ": " << name << " has " << s->GetAxis(0)->GetNbins();
+      if (s->GetNdimensions() > 1) {
+        std::cerr << " x " << s->GetAxis(1)->GetNbins();
+      }
+      std::cerr << " fine cells, which the bins given do not divide" << std::endl;
+      ok = false;
+    }
+    else {
+      std::cout << path << ": " << name << " -> " << h->GetNbinsX();
+      if (h->GetDimension() > 1) {
+        std::cout << " x " << h->GetNbinsY();
+      }
+      std::cout << " bins" << std::endl;
+
+      // The range is the same, so are the fill-time moments
+      if (old && old->GetDimension() == h->GetDimension()) {
+        double stats[TH1::kNstat];
+        old->GetStats(stats);
+        h->PutStats(stats);
+      }
+      else {
+        h->ResetStats();
+        h->SetEntries(s->GetEntries());
+      }
+
+      f->cd();
+      h->Write(name, TObject::kOverwrite);
+      delete h;
+    }
+    delete old;
+    delete s;
+  }
+
+  f->Close();
+  delete f;
+  return ok;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::vector<TString> files;
+  std::vector<Binning> binnings;
+  int njobs = 1;
+
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      njobs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--bins") == 0 && i + 2 < argc) {
+      Binning b;
+      b.pattern = argv[++i];
+      b.nx = atoi(argv[++i]);
+      b.ny = 0;
+      if (i + 1 < argc && isdigit(argv[i+1][0])) {
+        b.ny = atoi(argv[++i]);
+      }
+      binnings.push_back(b);
+    }
+    else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  if (files.empty() || binnings.empty() || njobs < 1) {
+    std::cout << "Usage: " << argv[0] << " [--jobs N] --bins HIST NX [NY] ... config_gen.root ..." << std::endl;
+    return 0;
+  }
+
+  gErrorIgnoreLevel = kError;
+  TH1::AddDirectory(false);
+  ROOT::EnableThreadSafety();
+
+  std::vector<int> failed(files.size(), 0);
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i=next++; i<files.size(); i=next++) {
+      failed[i] = !rebin_file(files[i], binnings);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=0; i<njobs; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  for (size_t i=0; i<threads.size(); i++) {
+    threads[i].join();
+  }
+
+  int nfailed = 0;
+  for (size_t i=0; i<files.size(); i++) {
+    nfailed += failed[i];
+  }
+  if (nfailed > 0) {
+    std::cerr << nfailed << " file(s) failed" << std::endl;
+  }
+
+  return (nfailed > 0);
+}
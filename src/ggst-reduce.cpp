@@ -0,0 +1,255 @@
+/**
+ * Merge the partial outputs of ggst --map into the final histograms.
+ *
+ * The partial files are shared out among worker threads, each summing its
+ * files into its own copy of the histograms, and the worker sums are then
+ * merged pairwise in a tree, so the merge scales with the number of cores
+ * rather than the number of files. Files that can't be read, come from a
+ * different sample, or are missing histograms are skipped, and listed at
+ * the end.
+ *
+ * The result is written to ./<config>_<gen>.root and rendered, as ggst
+ * would for the whole sample.
+ *
+ * Usage: ggst-reduce [--jobs N] [--no-render] [-o OUTPUT] partial.root ...
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <TError.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TClass.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TObjString.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TStyle.h>
+#include "render.h"
+
+/** Histograms by name */
+typedef std::map<std::string, TH1*> Histograms;
+
+/** A partial output: its sample tag ("config gen") and histograms. */
+struct Partial {
+  TString sample;
+  Histograms hists;
+};
+
+
+/** Delete a set of histograms. */
+void clear(Histograms& hists) {
+  for (auto const& h : hists) {
+    delete h.second;
+  }
+  hists.clear();
+}
+
+
+/** Read a partial output file. Returns false if it is unreadable. */
+bool read_partial(TString path, Partial& p) {
+  TFile* f = TFile::Open(path);
+  if (!f || f->IsZombie() || f->TestBit(TFile::kRecovered)) {
+    delete f;
+    return false;
+  }
+
+  TObjString* tag = (TObjString*) f->Get("sample");
+  if (!tag) {
+    delete f;
+    return false;
+  }
+  p.sample = tag->GetString();
+  delete tag;
+
+  TIter next(f->GetListOfKeys());
+  TKey* key;
+  while ((key = (TKey*) next())) {
+    TClass* cls = TClass::GetClass(key->GetClassName());
+    if (!cls || !cls->InheritsFrom("TH1")) {
+      continue;
+    }
+
+    TH1* h = (TH1*) key->ReadObj();
+    p.hists[h->GetName()] = h;
+  }
+
+  f->Close();
+  delete f;
+  return !p.hists.empty();
+}
+
+
+/** Add the histograms of b into a, and delete them. */
+void add(Histograms& a, Histograms& b) {
+  if (a.empty()) {
+    a.swap(b);
+    return;
+  }
+
+  for (auto const& h : b) {
+    a[h.first]->Add(h.second);
+    delete h.second;
+  }
+  b.clear();
+}
+
+
+int main(int argc, char* argv[]) {
+  std::vector<TString> files;
+  int njobs = 1;
+  bool render = true;
+  TString output;
+
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      njobs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--no-render") == 0) {
+      render = false;
+    }
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    }
+    else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  if (files.empty() || njobs < 1) {
+    std::cout << "Usage: " << argv[0] << " [--jobs N] [--no-render] [-o OUTPUT] partial.root ..." << std::endl;
+    return 0;
+  }
+
+  gROOT->SetBatch(true);
+  if (render) {
+    gROOT->ProcessLine(".x ~/.rootlogon.C");
+  }
+  gStyle->SetOptStat(0);
+  gErrorIgnoreLevel = kError;
+  TH1::AddDirectory(false);
+  ROOT::EnableThreadSafety();
+
+  // The first readable file sets the sample and the expected histograms
+  Partial ref;
+  size_t first = 0;
+  while (first < files.size() && !read_partial(files[first], ref)) {
+    clear(ref.hists);
+    first++;
+  }
+  if (first == files.size()) {
+    std::cerr << "No readable partial files" << std::endl;
+    return 1;
+  }
+
+  std::set<std::string> names;
+  for (auto const& h : ref.hists) {
+    names.insert(h.first);
+  }
+  clear(ref.hists);
+
+  TString config = ref.sample(0, ref.sample.Index(" "));
+  TString gen = ref.sample(ref.sample.Index(" ") + 1, ref.sample.Length());
+  std::cout << "Configuration: " << config << std::endl;
+  std::cout << "Generators: " << gen << std::endl;
+
+  // Check each file fully before adding it, so a bad file adds nothing
+  std::vector<std::string> status(files.size());
+  for (size_t i=0; i<first; i++) {
+    status[i] = "unreadable";
+  }
+
+  std::atomic<size_t> next(first);
+  std::vector<Histograms> sums(njobs);
+  auto worker = [&](int w) {
+    for (size_t i=next++; i<files.size(); i=next++) {
+      Partial p;
+      if (!read_partial(files[i], p)) {
+        status[i] = "unreadable";
+      }
+      else if (p.sample != ref.sample) {
+        status[i] = "from sample " + std::string(p.sample.Data());
+      }
+      else if (p.hists.size() != names.size()) {
+        status[i] = "histograms do not match";
+      }
+      else {
+        for (auto const& h : p.hists) {
+          if (!names.count(h.first)) {
+            status[i] = "histograms do not match";
+          }
+        }
+      }
+
+      if (status[i] == "") {
+        add(sums[w], p.hists);
+      }
+      clear(p.hists);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=0; i<njobs; i++) {
+    threads.push_back(std::thread(worker, i));
+  }
+  for (size_t i=0; i<threads.size(); i++) {
+    threads[i].join();
+  }
+
+  // Tree reduction of the per-worker sums
+  for (int step=1; step<njobs; step*=2) {
+    threads.clear();
+    for (int i=0; i+step<njobs; i+=2*step) {
+      threads.push_back(std::thread(add, std::ref(sums[i]),
+                                    std::ref(sums[i + step])));
+    }
+    for (size_t i=0; i<threads.size(); i++) {
+      threads[i].join();
+    }
+  }
+
+  int failed = 0;
+  for (size_t i=0; i<files.size(); i++) {
+    if (status[i] != "") {
+      std::cerr << "Skipped " << files[i] << ": " << status[i] << std::endl;
+      failed++;
+    }
+  }
+  std::cout << "Merged " << files.size() - failed << " of "
+            << files.size() << " files" << std::endl;
+
+  // Output, as written by ggst
+  if (output == "") {
+    output = TString("./") + config + "_" + gen + ".root";
+  }
+  TFile* fout = TFile::Open(output, "recreate");
+  if (!fout || fout->IsZombie()) {
+    std::cerr << "Cannot open " << output << std::endl;
+    return 1;
+  }
+
+  for (auto const& h : sums[0]) {
+    std::cout << "Writing " << h.first << std::endl;
+    fout->cd();
+    h.second->Write();
+
+    // Universe bands and copies aren't drawn, as in ggst
+    TString name = h.second->GetName();
+    if (render && !name.EndsWith("_band") && !name.EndsWith("_universes")) {
+      Render(h.second, config, gen, fout);
+    }
+  }
+
+  fout->Close();
+  clear(sums[0]);
+
+  return (failed > 0);
+}
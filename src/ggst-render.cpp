@@ -0,0 +1,145 @@
+/**
+ * Render the histograms in ggst output files to canvases and PDFs.
+ *
+ * Takes files written by ggst --no-render, and adds to each the canvases
+ * ggst would have drawn (c_<histogram>), saving them as PDFs in the current
+ * directory. Previews and partial outputs are labelled with their sample.
+ * Files are rendered in parallel worker processes, since ROOT graphics are
+ * not thread safe.
+ *
+ * Usage: ggst-render [--jobs N] <config>_<gen>.root ...
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <TError.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TClass.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TStyle.h>
+#include <TSystem.h>
+#include "render.h"
+
+/** Render all histograms in one file. */
+int render_file(TString path) {
+  gROOT->SetBatch(true);
+  gROOT->ProcessLine(".x ~/.rootlogon.C");
+  gStyle->SetOptStat(0);
+  gErrorIgnoreLevel = kError;
+
+  // Configuration and generators from <config>_<gen>.root, or from a
+  // preview (<config>_<gen>.preview.root) or partial output
+  // (<config>_<gen>.<input>.part.root)
+  TString name = gSystem->BaseName(path);
+  if (name.EndsWith(".root")) {
+    name.Remove(name.Length() - 5);
+  }
+  int split = name.Index("_");
+  if (split < 0) {
+    std::cerr << "Can't find config_gen in " << path << std::endl;
+    return 1;
+  }
+  if (name.EndsWith(".preview")) {
+    name.Remove(name.Length() - 8);
+  }
+  else if (name.EndsWith(".part") && name.Index(".", split) > 0) {
+    name.Remove(name.Index(".", split));
+  }
+  TString config = name(0, split);
+  TString gen = name(split + 1, name.Length() - split - 1);
+
+  TFile* f = TFile::Open(path, "update");
+  if (!f || f->IsZombie()) {
+    std::cerr << "Cannot open " << path << std::endl;
+    return 1;
+  }
+
+  // Collect the histograms first, since writing the canvases changes the
+  // keys. The universe band and universe copies aren't drawn, as in ggst.
+  std::vector<TString> hists;
+  TIter next(f->GetListOfKeys());
+  TKey* key;
+  while ((key = (TKey*) next())) {
+    TClass* cls = TClass::GetClass(key->GetClassName());
+    TString hname = key->GetName();
+    if (!cls || !cls->InheritsFrom("TH1") ||
+        hname.EndsWith("_band") || hname.EndsWith("_universes")) {
+      continue;
+    }
+    hists.push_back(hname);
+  }
+
+  for (size_t i=0; i<hists.size(); i++) {
+    TH1* h = (TH1*) f->Get(hists[i]);
+    std::cout << "Rendering " << path << " " << h->GetName() << std::endl;
+    Render(h, config, gen, f);
+  }
+
+  f->Close();
+  return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::vector<TString> files;
+  int njobs = 1;
+
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      njobs = atoi(argv[++i]);
+    }
+    else {
+      files.push_back(argv[i]);
+    }
+  }
+
+  if (files.empty() || njobs < 1) {
+    std::cout << "Usage: " << argv[0] << " [--jobs N] \"config_gen.root\" ..." << std::endl;
+    return 0;
+  }
+
+  // Fork one worker per file, at most njobs at a time
+  int running = 0;
+  int failed = 0;
+  for (size_t i=0; i<files.size(); i++) {
+    if (running == njobs) {
+      int status;
+      wait(&status);
+      failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+      running--;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      _exit(render_file(files[i]));
+    }
+    else if (pid < 0) {
+      std::cerr << "Cannot fork for " << files[i] << std::endl;
+      failed++;
+      continue;
+    }
+    running++;
+  }
+
+  while (running > 0) {
+    int status;
+    wait(&status);
+    failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    running--;
+  }
+
+  if (failed > 0) {
+    std::cerr << failed << " file(s) failed" << std::endl;
+  }
+
+  return (failed > 0);
+}
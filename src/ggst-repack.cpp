@@ -0,0 +1,332 @@
+/**
+ * Repack a sample's GST files for reading by ggst.
+ *
+ * The grid writes each sample as many small files, with the default
+ * compression and the small baskets and clusters that suit writing. This
+ * merges them, in order, into a few large files holding only the branches
+ * ggst reads (the Event bindings; --keep-all keeps every branch), with a
+ * codec that is fast to decompress (LZ4 by default, or ZSTD for smaller
+ * files) and clusters of --cluster entries. ROOT sizes the baskets at the
+ * first cluster so that each branch of a cluster is about one basket, and
+ * a column-selective read then fetches a few large baskets per cluster.
+ *
+ * The inputs are split into outputs of about --size MB of input each, and
+ * written --jobs at a time to OUTDIR/<sample>/gntp.<i>.ghep.gst.root, where
+ * <sample> is the directory of the inputs, so ggst finds the configuration
+ * and generators as usual. Entries keep their order, so ggst output for the
+ * repacked sample (including universe weights, which depend on the entry
+ * number) is identical. With --verify, each output is read back and
+ * compared with its inputs, entry by entry, on every branch ggst reads.
+ *
+ * Files that can't be read are skipped and listed at the end.
+ *
+ * Usage: ggst-repack [--size MB] [--codec lz4|zstd|zlib] [--level N]
+ *                    [--cluster ENTRIES] [--basket BYTES] [--keep-all]
+ *                    [--jobs N] [--verify] OUTDIR FILE ...
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <Compression.h>
+#include <TChain.h>
+#include <TError.h>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TObjString.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TTree.h>
+#include "event.h"
+#include "ledger.h"
+#include "catalog.h"
+
+/** How outputs are written */
+struct Settings {
+  int compression;  //!< ROOT compression settings
+  long cluster;  //!< Entries per cluster
+  int basket;  //!< Initial basket size (bytes)
+  bool keepAll;  //!< Keep branches ggst doesn't read
+};
+
+
+/** The branches ggst can read: those bound by Event. */
+std::set<std::string> event_branches() {
+  Event ev(NULL);
+  std::set<std::string> names;
+  for (size_t i=0; i<ev.bindings.size(); i++) {
+    names.insert(ev.bindings[i].name);
+  }
+  return names;
+}
+
+
+/**
+ * Copy the entries of files, in order, to a new file at path. Returns the
+ * number of entries written, or -1 on error.
+ */
+long repack(const std::vector<TString>& files, std::string path,
+            const std::set<std::string>& branches, const Settings& s) {
+  TChain in("gst");
+  for (size_t i=0; i<files.size(); i++) {
+    in.Add(files[i]);
+  }
+
+  // Only the active branches are cloned
+  if (!s.keepAll) {
+    in.SetBranchStatus("*", false);
+    for (auto const& name : branches) {
+      in.SetBranchStatus(name.c_str(), true);
+    }
+  }
+
+  TFile out(path.c_str(), "recreate", "", s.compression);
+  if (out.IsZombie()) {
+    std::cerr << "Cannot open " << path << std::endl;
+    return -1;
+  }
+
+  in.LoadTree(0);
+  TTree* t = in.CloneTree(0);
+  t->SetDirectory(&out);
+  t->SetAutoFlush(s.cluster);
+  t->SetBasketSize("*", s.basket);
+
+  long n = in.GetEntries();
+  for (long i=0; i<n; i++) {
+    if (in.GetEntry(i) < 0) {
+      std::cerr << "Failed to read entry " << i << " for " << path << std::endl;
+      return -1;
+    }
+    t->Fill();
+  }
+
+  out.cd();
+  t->Write();
+  out.Close();
+  return n;
+}
+
+
+/**
+ * Compare the branches ggst reads in files and in their repacked copy at
+ * path, entry by entry. Returns the number of entries that differ, or -1
+ * if the entry counts differ.
+ */
+long verify(const std::vector<TString>& files, std::string path,
+            const std::set<std::string>& branches) {
+  TChain a("gst"), b("gst");
+  for (size_t i=0; i<files.size(); i++) {
+    a.Add(files[i]);
+  }
+  b.Add(path.c_str());
+
+  long n = a.GetEntries();
+  if (b.GetEntries() != n) {
+    return -1;
+  }
+
+  Event ea(&a), eb(&b);
+  ea.SetActive(branches);
+  eb.SetActive(branches);
+
+  // Per-particle arrays are compared up to their count
+  long bad = 0;
+  for (long i=0; i<n; i++) {
+    ea.GetEntry(i);
+    eb.GetEntry(i);
+    for (size_t k=0; k<ea.bindings.size(); k++) {
+      const Event::Binding& x = ea.bindings[k];
+      const Event::Binding& y = eb.bindings[k];
+      size_t bytes = x.size;
+      if (x.count) {
+        if (*x.count != *y.count) {
+          bad++;
+          break;
+        }
+        int m = std::max(0, std::min(*x.count, Event::kNPmax));
+        bytes = x.size / Event::kNPmax * m;
+      }
+      if (memcmp(x.addr, y.addr, bytes) != 0) {
+        bad++;
+        break;
+      }
+    }
+  }
+
+  return bad;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::vector<TString> patterns;
+  std::string outdir, codec = "lz4";
+  double sizeMB = 1000;
+  int level = -1;
+  int njobs = 1;
+  bool check = false;
+  Settings s;
+  s.cluster = 20000;
+  s.basket = 128000;
+  s.keepAll = false;
+
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      sizeMB = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--codec") == 0 && i + 1 < argc) {
+      codec = argv[++i];
+    }
+    else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+      level = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--cluster") == 0 && i + 1 < argc) {
+      s.cluster = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--basket") == 0 && i + 1 < argc) {
+      s.basket = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--keep-all") == 0) {
+      s.keepAll = true;
+    }
+    else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      njobs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--verify") == 0) {
+      check = true;
+    }
+    else if (outdir == "") {
+      outdir = argv[i];
+    }
+    else {
+      patterns.push_back(argv[i]);
+    }
+  }
+
+  // Default levels are ROOT's recommendations for each codec
+  using namespace ROOT::RCompressionSetting;
+  if (codec == "lz4") {
+    s.compression = ROOT::CompressionSettings(EAlgorithm::kLZ4, level < 0 ? 4 : level);
+  }
+  else if (codec == "zstd") {
+    s.compression = ROOT::CompressionSettings(EAlgorithm::kZSTD, level < 0 ? 5 : level);
+  }
+  else if (codec == "zlib") {
+    s.compression = ROOT::CompressionSettings(EAlgorithm::kZLIB, level < 0 ? 1 : level);
+  }
+  else {
+    std::cerr << "Unknown codec " << codec << " (use lz4, zstd or zlib)" << std::endl;
+    return 1;
+  }
+
+  if (outdir == "" || patterns.empty() || sizeMB <= 0 || s.cluster < 1 ||
+      s.basket < 1 || njobs < 1) {
+    std::cout << "Usage: " << argv[0] << " [--size MB] [--codec lz4|zstd|zlib] [--level N] [--cluster ENTRIES] [--basket BYTES] [--keep-all] [--jobs N] [--verify] OUTDIR FILE ..." << std::endl;
+    return 0;
+  }
+
+  std::vector<TString> files = ExpandFiles(patterns);
+  if (files.empty()) {
+    std::cerr << "No input files" << std::endl;
+    return 1;
+  }
+
+  gErrorIgnoreLevel = kError;
+  ROOT::EnableThreadSafety();
+
+  // Check every input up front, so bad files are left out of the outputs
+  Catalog catalog;
+  catalog.Update(files, njobs);
+
+  // Split the readable files, in order, into outputs of about sizeMB each
+  std::vector<std::vector<TString> > groups(1);
+  std::vector<TString> skipped;
+  double bytes = 0;
+  for (size_t i=0; i<files.size(); i++) {
+    const FileInfo* info = catalog.Find(files[i].Data());
+    if (info->entries < 0) {
+      std::cerr << "Skipped " << files[i] << ": " << info->error << std::endl;
+      skipped.push_back(files[i]);
+      continue;
+    }
+    if (info->entries == 0) {
+      continue;
+    }
+    if (bytes >= sizeMB * 1e6) {
+      groups.push_back(std::vector<TString>());
+      bytes = 0;
+    }
+    groups.back().push_back(files[i]);
+    bytes += info->stamp.size;
+  }
+  if (groups.back().empty()) {
+    groups.pop_back();
+  }
+
+  // Outputs go in a directory named as the inputs', for ggst
+  TObjArray* path = files[0].Tokenize("/");
+  TString sample = ((TObjString*)(path->At(std::max(0, path->GetEntries() - 2))))->GetString();
+  delete path;
+  std::string dir = outdir + "/" + sample.Data();
+  mkdir(outdir.c_str(), 0755);
+  mkdir(dir.c_str(), 0755);
+  std::cout << "Output: " << dir << " (" << groups.size() << " files)" << std::endl;
+
+  std::set<std::string> branches = event_branches();
+  std::vector<long> written(groups.size(), -1), differ(groups.size(), 0);
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i=next++; i<groups.size(); i=next++) {
+      std::string out = dir + "/gntp." + std::to_string(i) + ".ghep.gst.root";
+      written[i] = repack(groups[i], out, branches, s);
+      if (written[i] >= 0 && check) {
+        differ[i] = verify(groups[i], out, branches);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=0; i<njobs; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  for (size_t i=0; i<threads.size(); i++) {
+    threads[i].join();
+  }
+
+  int failed = 0;
+  long entries = 0;
+  for (size_t i=0; i<groups.size(); i++) {
+    std::string out = "gntp." + std::to_string(i) + ".ghep.gst.root";
+    if (written[i] < 0) {
+      std::cerr << "Failed: " << out << std::endl;
+      failed++;
+    }
+    else if (differ[i] < 0) {
+      std::cerr << "Verify: " << out << " has the wrong number of entries" << std::endl;
+      failed++;
+    }
+    else if (differ[i] > 0) {
+      std::cerr << "Verify: " << out << " differs from its inputs in "
+                << differ[i] << " entries" << std::endl;
+      failed++;
+    }
+    else {
+      std::cout << out << ": " << groups[i].size() << " files, "
+                << written[i] << " entries" << std::endl;
+      entries += written[i];
+    }
+  }
+
+  std::cout << "Repacked " << files.size() - skipped.size() << " of "
+            << files.size() << " files, " << entries << " entries"
+            << (check && failed == 0 ? ", verified" : "") << std::endl;
+
+  return (failed > 0 || !skipped.empty());
+}
@@ -0,0 +1,399 @@
+/**
+ * Summarize and compare ggst outputs across samples.
+ *
+ * Reads the stored histograms of each <config>_<gen>.root in parallel, and
+ * writes to one file (summary.root by default):
+ *
+ *   - models_<hist>: the fraction of each sample's events in each bin of
+ *     the interaction mode and particle count histograms, with the samples
+ *     along x.
+ *   - ratio_<hist>_<B>_<A>: the ratio B/A for each pair of samples given
+ *     with --pair A B, for each histogram given with --ratio (by default
+ *     CCQE muon T/cos theta, and 1l1p q0/q3).
+ *   - With --nue DIR, numnue_<hist>_<S>: the ratio of each sample S to the
+ *     output of the same name in DIR (e.g. nu_mu over nu_e fluxes), and
+ *     double_<hist>_<B>_<A>: the ratio of B's num/nue ratio to A's.
+ *
+ * Samples in pairs are named by <config>_<gen>, or just the configuration.
+ * Each plot is also saved as a PDF alongside the output, unless
+ * --no-render is given.
+ *
+ * Usage: ggst-summary [--jobs N] [--no-render] [-o OUTPUT] [--nue DIR]
+ *                     [--pair A B]... [--ratio HIST]... <config>_<gen>.root ...
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <TCanvas.h>
+#include <TError.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TH2F.h>
+#include <TROOT.h>
+#include <TString.h>
+#include <TStyle.h>
+#include <TSystem.h>
+
+/** Histograms by name */
+typedef std::map<std::string, TH1*> Histograms;
+
+/** Channel and particle count histograms, summarized as fractions */
+const char* kMatrices[] = {
+  "h_all_intmode", "h_1l1p_intmode",
+  "h_all_nip", "h_all_nin", "h_all_nipip", "h_all_nipim", "h_all_nipi0", "h_all_nikp",
+  "h_all_nfp", "h_all_nfn", "h_all_nfpip", "h_all_nfpim", "h_all_nfpi0", "h_all_nfkp",
+};
+
+/** Histograms compared between samples, without --ratio */
+const char* kRatios[] = { "h_ccqe_tctmu", "h_1l1p_q0q3" };
+
+/** A ggst output, and its counterpart for the nue ratios. */
+struct Sample {
+  TString path;
+  TString name;  //!< <config>_<gen>
+  TString config;
+  Histograms num;  //!< Histograms from path
+  Histograms nue;  //!< Histograms from the --nue directory
+  std::string status;  //!< Why the sample was skipped, if it was
+};
+
+
+/** Delete a set of histograms. */
+void clear(Histograms& hists) {
+  for (auto const& h : hists) {
+    delete h.second;
+  }
+  hists.clear();
+}
+
+
+/**
+ * Read the named histograms from a file; missing ones are left out.
+ *
+ * Returns false if the file can't be read.
+ */
+bool read_hists(TString path, const std::set<std::string>& names,
+                Histograms& hists) {
+  TFile* f = TFile::Open(path);
+  if (!f || f->IsZombie()) {
+    delete f;
+    return false;
+  }
+
+  for (auto const& name : names) {
+    TH1* h = dynamic_cast<TH1*>(f->Get(name.c_str()));
+    if (h) {
+      hists[name] = h;
+    }
+  }
+
+  f->Close();
+  delete f;
+  return true;
+}
+
+
+/** A histogram name without the h_ prefix, for naming its summaries. */
+TString short_name(std::string hist) {
+  return (hist.compare(0, 2, "h_") == 0 ? hist.substr(2) : hist).c_str();
+}
+
+
+/** Index of the sample with a name or configuration, or -1. */
+int find(const std::vector<Sample>& samples, TString name) {
+  for (size_t i=0; i<samples.size(); i++) {
+    if (samples[i].status == "" &&
+        (samples[i].name == name || samples[i].config == name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+/**
+ * Fractions of each sample's entries in each bin of a histogram.
+ *
+ * Returns NULL if no sample has the histogram.
+ */
+TH2F* matrix(const std::vector<Sample>& samples, std::string name) {
+  const TH1* ref = NULL;
+  for (size_t i=0; i<samples.size() && !ref; i++) {
+    Histograms::const_iterator it = samples[i].num.find(name);
+    if (it != samples[i].num.end()) {
+      ref = it->second;
+    }
+  }
+  if (!ref) {
+    return NULL;
+  }
+
+  const TAxis* x = ref->GetXaxis();
+  int ny = x->GetNbins();
+  TH2F* m = new TH2F("models_" + short_name(name), "",
+                     samples.size(), 0, samples.size(),
+                     ny, x->GetXmin(), x->GetXmax());
+  m->GetYaxis()->SetTitle(x->GetTitle());
+  for (int i=1; i<=ny; i++) {
+    if (strlen(x->GetBinLabel(i)) > 0) {
+      m->GetYaxis()->SetBinLabel(i, x->GetBinLabel(i));
+    }
+  }
+
+  for (size_t j=0; j<samples.size(); j++) {
+    m->GetXaxis()->SetBinLabel(j + 1, samples[j].config);
+    Histograms::const_iterator it = samples[j].num.find(name);
+    if (it == samples[j].num.end()) {
+      continue;
+    }
+    double n = it->second->Integral();
+    for (int i=1; i<=ny && n > 0; i++) {
+      m->SetBinContent(j + 1, i, it->second->GetBinContent(i) / n);
+    }
+  }
+
+  return m;
+}
+
+
+/** The ratio a/b, or NULL (with a message) if the binnings differ. */
+TH1* ratio(const TH1* a, const TH1* b, TString name) {
+  if (a->GetNcells() != b->GetNcells()) {
+    std::cerr << "Can't divide " << a->GetName() << " by " << b->GetName()
+              << ": binnings differ" << std::endl;
+    return NULL;
+  }
+  TH1* r = (TH1*) a->Clone(name);
+  r->Divide(b);
+  return r;
+}
+
+
+/**
+ * Add the ratio of histogram hist in a and b to the outputs.
+ *
+ * Returns the ratio, or NULL if either is missing or they don't divide.
+ */
+TH1* add_ratio(const Histograms& a, const Histograms& b, std::string hist,
+               TString name, std::vector<TH1*>& out) {
+  Histograms::const_iterator ia = a.find(hist);
+  Histograms::const_iterator ib = b.find(hist);
+  if (ia == a.end() || ib == b.end()) {
+    std::cerr << "Missing " << hist << " for " << name << std::endl;
+    return NULL;
+  }
+  TH1* r = ratio(ia->second, ib->second, name);
+  if (r) {
+    out.push_back(r);
+  }
+  return r;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::vector<Sample> samples;
+  std::vector<std::pair<TString, TString> > pairs;
+  std::vector<std::string> ratios;
+  int njobs = 1;
+  bool render = true;
+  TString output = "summary.root";
+  TString nue;
+
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      njobs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--no-render") == 0) {
+      render = false;
+    }
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    }
+    else if (strcmp(argv[i], "--nue") == 0 && i + 1 < argc) {
+      nue = argv[++i];
+    }
+    else if (strcmp(argv[i], "--pair") == 0 && i + 2 < argc) {
+      pairs.push_back(std::make_pair(TString(argv[i+1]), TString(argv[i+2])));
+      i += 2;
+    }
+    else if (strcmp(argv[i], "--ratio") == 0 && i + 1 < argc) {
+      ratios.push_back(argv[++i]);
+    }
+    else {
+      Sample s;
+      s.path = argv[i];
+      s.name = gSystem->BaseName(s.path);
+      s.name.ReplaceAll(".root", "");
+      s.config = s.name(0, s.name.Index("_"));
+      samples.push_back(s);
+    }
+  }
+
+  if (samples.empty() || njobs < 1) {
+    std::cout << "Usage: " << argv[0] << " [--jobs N] [--no-render] [-o OUTPUT] [--nue DIR] [--pair A B]... [--ratio HIST]... <config>_<gen>.root ..." << std::endl;
+    return 0;
+  }
+
+  if (ratios.empty()) {
+    ratios.assign(kRatios, kRatios + sizeof(kRatios) / sizeof(kRatios[0]));
+  }
+
+  gROOT->SetBatch(true);
+  if (render) {
+    gROOT->ProcessLine(".x ~/.rootlogon.C");
+  }
+  gStyle->SetOptStat(0);
+  gErrorIgnoreLevel = kError;
+  TH1::AddDirectory(false);
+  ROOT::EnableThreadSafety();
+
+  std::set<std::string> names(ratios.begin(), ratios.end());
+  std::set<std::string> nueNames(names);
+  for (size_t i=0; i<sizeof(kMatrices) / sizeof(kMatrices[0]); i++) {
+    names.insert(kMatrices[i]);
+  }
+
+  // Read the samples in parallel, each worker taking the next file
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i=next++; i<samples.size(); i=next++) {
+      Sample& s = samples[i];
+      if (!read_hists(s.path, names, s.num)) {
+        s.status = "unreadable";
+      }
+      else if (nue != "" &&
+               !read_hists(nue + "/" + gSystem->BaseName(s.path), nueNames, s.nue)) {
+        s.status = "no nue output";
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i=0; i<njobs; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  for (size_t i=0; i<threads.size(); i++) {
+    threads[i].join();
+  }
+
+  // Skip unreadable samples, so they don't leave gaps in the matrices
+  std::vector<Sample> good;
+  for (size_t i=0; i<samples.size(); i++) {
+    if (samples[i].status != "") {
+      std::cerr << "Skipped " << samples[i].path << ": " << samples[i].status << std::endl;
+      clear(samples[i].num);
+      clear(samples[i].nue);
+    }
+    else {
+      good.push_back(samples[i]);
+    }
+  }
+  samples.swap(good);
+
+  for (size_t i=0; i<samples.size(); i++) {
+    Histograms::const_iterator it = samples[i].num.find("h_all_intmode");
+    std::cout << samples[i].name << " "
+              << (it != samples[i].num.end() ? it->second->Integral() : 0)
+              << std::endl;
+  }
+
+  // Channel fraction matrices
+  std::vector<TH1*> matrices;
+  for (size_t i=0; i<sizeof(kMatrices) / sizeof(kMatrices[0]); i++) {
+    TH2F* m = matrix(samples, kMatrices[i]);
+    if (m) {
+      matrices.push_back(m);
+    }
+  }
+
+  // Single and double ratios
+  std::vector<TH1*> singles, doubles;
+  std::vector<std::map<std::string, TH1*> > numnue(samples.size());
+  if (nue != "") {
+    for (size_t i=0; i<samples.size(); i++) {
+      for (size_t j=0; j<ratios.size(); j++) {
+        TString name = "numnue_" + short_name(ratios[j]) + "_" + samples[i].name;
+        TH1* r = add_ratio(samples[i].num, samples[i].nue, ratios[j], name, singles);
+        if (r) {
+          numnue[i][ratios[j]] = r;
+        }
+      }
+    }
+  }
+
+  for (size_t i=0; i<pairs.size(); i++) {
+    int a = find(samples, pairs[i].first);
+    int b = find(samples, pairs[i].second);
+    if (a < 0 || b < 0) {
+      std::cerr << "No sample " << (a < 0 ? pairs[i].first : pairs[i].second)
+                << " for pair" << std::endl;
+      continue;
+    }
+
+    for (size_t j=0; j<ratios.size(); j++) {
+      TString suffix = short_name(ratios[j]) + "_" + pairs[i].second + "_" + pairs[i].first;
+      add_ratio(samples[b].num, samples[a].num, ratios[j], "ratio_" + suffix, singles);
+
+      if (numnue[a].count(ratios[j]) && numnue[b].count(ratios[j])) {
+        TH1* r = ratio(numnue[b][ratios[j]], numnue[a][ratios[j]], "double_" + suffix);
+        if (r) {
+          doubles.push_back(r);
+        }
+      }
+    }
+  }
+
+  TFile* fout = TFile::Open(output, "recreate");
+  if (!fout || fout->IsZombie()) {
+    std::cerr << "Cannot open " << output << std::endl;
+    return 1;
+  }
+
+  TString dir = gSystem->DirName(output);
+  std::vector<TH1*> all(matrices);
+  all.insert(all.end(), singles.begin(), singles.end());
+  all.insert(all.end(), doubles.begin(), doubles.end());
+
+  for (size_t i=0; i<all.size(); i++) {
+    TH1* h = all[i];
+    std::cout << "Writing " << h->GetName() << std::endl;
+    fout->cd();
+    h->Write();
+
+    if (render) {
+      TCanvas c;
+      if (i < matrices.size()) {
+        h->Draw("colz text");
+        c.SetBottomMargin(0.22);
+        c.SetRightMargin(0.15);
+      }
+      else {
+        h->SetMinimum(i < matrices.size() + singles.size() ? 0.5 : 0.0);
+        h->SetMaximum(2.0);
+        h->Draw(h->GetDimension() == 2 ? "colz" : "e1");
+      }
+      c.Update();
+      c.SaveAs(dir + "/" + h->GetName() + ".pdf");
+    }
+  }
+
+  fout->Close();
+
+  for (size_t i=0; i<all.size(); i++) {
+    delete all[i];
+  }
+  for (size_t i=0; i<samples.size(); i++) {
+    clear(samples[i].num);
+    clear(samples[i].nue);
+  }
+
+  return 0;
+}
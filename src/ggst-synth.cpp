@@ -0,0 +1,345 @@
+/**
+ * Generate synthetic GST files, for benchmarking without GENIE.
+ *
+ * Writes gst trees with the branch layout bound by Event (the branches are
+ * made from Event's own bindings), filled with a rough model of neutrino
+ * interactions on argon: a mix of CC and NC QE, MEC, RES, DIS and COH
+ * events, with realistic particle multiplicities before and after FSI. The
+ * physics is only good enough to give representative selection
+ * efficiencies and branch sizes; use real GENIE output for anything else.
+ *
+ * Output goes to OUTDIR/<config>_<gen>_<seed>/gntp.<i>.ghep.gst.root, so
+ * ggst finds the configuration and generators as usual. The same seed
+ * always gives the same files.
+ *
+ * Usage: ggst-synth [--events N] [--files F] [--seed S] [--config NAME]
+ *                   [--gen NAME] OUTDIR
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <TFile.h>
+#include <TRandom3.h>
+#include <TString.h>
+#include <TTree.h>
+#include "event.h"
+
+/// Masses (GeV)
+const double kMp = 0.938272;
+const double kMn = 0.939565;
+const double kMpi = 0.139570;
+const double kMpi0 = 0.134977;
+const double kMmu = 0.105658;
+const double kMe = 0.000511;
+
+/** A particle in a GST list. */
+struct Particle {
+  int pdg;
+  double e, px, py, pz;
+};
+
+
+/** Mass for the PDG codes the generator makes. */
+double mass(int pdg) {
+  switch (abs(pdg)) {
+    case 2212: return kMp;
+    case 2112: return kMn;
+    case 211: return kMpi;
+    case 111: return kMpi0;
+    default: return 0;
+  }
+}
+
+
+/**
+ * A particle with kinetic energy ke, emitted at an angle to the direction
+ * (ux, uy, uz) with cos theta from 1 - Exp(spread).
+ */
+Particle make(TRandom3& r, int pdg, double ke,
+              double ux, double uy, double uz, double spread) {
+  double m = mass(pdg);
+  double p = sqrt(ke * (ke + 2 * m));
+
+  // Direction: smear the axis, then rotate from z
+  double ct = std::max(-1.0, 1 - r.Exp(spread));
+  double st = sqrt(1 - ct * ct);
+  double phi = r.Uniform(0, 2 * M_PI);
+  double dx = st * cos(phi), dy = st * sin(phi), dz = ct;
+
+  double uperp = sqrt(ux * ux + uy * uy);
+  Particle q = { pdg, ke + m, 0, 0, 0 };
+  if (uperp < 1e-9) {
+    q.px = p * dx;
+    q.py = p * dy;
+    q.pz = p * dz * (uz < 0 ? -1 : 1);
+  }
+  else {
+    // Rotation taking z to u
+    double ax = -uy / uperp, ay = ux / uperp;
+    double c = uz, s = uperp;
+    double kd = ax * dx + ay * dy;
+    double rx = dx * c + (ay * dz) * s + ax * kd * (1 - c);
+    double ry = dy * c + (-ax * dz) * s + ay * kd * (1 - c);
+    double rz = dz * c + (ax * dy - ay * dx) * s;
+    q.px = p * rx;
+    q.py = p * ry;
+    q.pz = p * rz;
+  }
+  return q;
+}
+
+
+/** Copy a particle list into the Event arrays, with the per-type counts. */
+void store(const std::vector<Particle>& ps, int& n, int* pdg, double* e,
+           double* px, double* py, double* pz, int& np, int& nn, int& npip,
+           int& npim, int& npi0, int& nkp, int& nkm, int& nk0, int& nem) {
+  n = std::min((int) ps.size(), Event::kNPmax);
+  np = nn = npip = npim = npi0 = nkp = nkm = nk0 = nem = 0;
+
+  for (int i=0; i<n; i++) {
+    pdg[i] = ps[i].pdg;
+    e[i] = ps[i].e;
+    px[i] = ps[i].px;
+    py[i] = ps[i].py;
+    pz[i] = ps[i].pz;
+
+    switch (ps[i].pdg) {
+      case 2212: np++; break;
+      case 2112: nn++; break;
+      case 211: npip++; break;
+      case -211: npim++; break;
+      case 111: npi0++; break;
+      case 321: nkp++; break;
+      case -321: nkm++; break;
+      case 311: case -311: case 130: case 310: nk0++; break;
+      case 22: case 11: case -11: nem++; break;
+    }
+  }
+}
+
+
+/** A random pion, with charges in equal parts. */
+int pion(TRandom3& r) {
+  static const int pdg[3] = { 211, -211, 111 };
+  return pdg[(int) r.Integer(3)];
+}
+
+
+/** Generate one event into the Event buffers. */
+void generate(TRandom3& r, Event& ev) {
+  // Flavor: mostly numu, as in the BNB
+  double u = r.Rndm();
+  ev.neu = (u < 0.85 ? 14 : u < 0.90 ? -14 : u < 0.99 ? 12 : -12);
+  ev.tgt = 1000180400;
+
+  // Energy: a gamma distribution with a mean of 0.8 GeV
+  ev.enu = std::max(0.2, -0.4 * (log(r.Rndm()) + log(r.Rndm())));
+
+  // Channel
+  ev.cc = (r.Rndm() < 0.75);
+  ev.nc = !ev.cc;
+  ev.qel = ev.res = ev.dis = ev.coh = false;
+  ev.dfr = ev.imd = ev.nuel = false;
+  double c = r.Rndm();
+  bool mec = false;
+  double ylo, yhi;
+  if (c < 0.40) {
+    ev.qel = true;
+    ev.nuance_code = (ev.cc ? 1 : 2);
+    ylo = 0.02; yhi = 0.4;
+  }
+  else if (c < 0.50) {
+    mec = true;
+    ev.nuance_code = 0;
+    ylo = 0.05; yhi = 0.5;
+  }
+  else if (c < 0.80) {
+    ev.res = true;
+    ev.nuance_code = (ev.cc ? 3 : 6);
+    ylo = 0.1; yhi = 0.7;
+  }
+  else if (c < 0.98) {
+    ev.dis = true;
+    ev.nuance_code = (ev.cc ? 91 : 92);
+    ylo = 0.1; yhi = 0.9;
+  }
+  else {
+    ev.coh = true;
+    ev.nuance_code = (ev.cc ? 97 : 96);
+    ylo = 0.02; yhi = 0.3;
+  }
+
+  // Lepton, with the neutrino along z
+  double ml = (ev.nc ? 0 : abs(ev.neu) == 14 ? kMmu : kMe);
+  double yv = r.Uniform(ylo, yhi);
+  ev.elep = std::max(ml + 1e-6, ev.enu * (1 - yv));
+  double pl = sqrt(ev.elep * ev.elep - ml * ml);
+  double ct = std::max(-1.0, 1 - r.Exp(0.15));
+  double st = sqrt(1 - ct * ct);
+  double phi = r.Uniform(0, 2 * M_PI);
+  ev.pxv = ev.pyv = 0;
+  ev.pzv = ev.enu;
+  ev.pxl = pl * st * cos(phi);
+  ev.pyl = pl * st * sin(phi);
+  ev.pzl = pl * ct;
+
+  // Momentum and energy transfer
+  double q0 = ev.enu - ev.elep;
+  double qx = -ev.pxl, qy = -ev.pyl, qz = ev.enu - ev.pzl;
+  double q3 = sqrt(qx * qx + qy * qy + qz * qz);
+  ev.q2 = q3 * q3 - q0 * q0;
+  ev.w = sqrt(std::max(0.0, kMp * kMp + 2 * kMp * q0 - ev.q2));
+  ev.x = (q0 > 0 ? ev.q2 / (2 * kMp * q0) : 0);
+  ev.y = q0 / ev.enu;
+  ev.t = 0;
+  double ux = qx / q3, uy = qy / q3, uz = qz / q3;
+
+  // Primary hadronic system
+  std::vector<Particle> pre;
+  bool nubar = (ev.neu < 0);
+  int nucleon = (ev.nc ? (r.Rndm() < 0.5 ? 2212 : 2112) :
+                 nubar ? 2112 : 2212);
+  double avail = std::max(0.001, q0 - 0.025);
+  if (ev.qel) {
+    pre.push_back(make(r, nucleon, avail, ux, uy, uz, 0.2));
+  }
+  else if (mec) {
+    int other = (r.Rndm() < 0.5 ? 2212 : 2112);
+    double f = r.Uniform(0.2, 0.8);
+    pre.push_back(make(r, nucleon, f * avail, ux, uy, uz, 0.5));
+    pre.push_back(make(r, other, (1 - f) * avail, ux, uy, uz, 0.5));
+  }
+  else if (ev.res) {
+    double f = r.Uniform(0.3, 0.7);
+    pre.push_back(make(r, nucleon, f * avail, ux, uy, uz, 0.4));
+    pre.push_back(make(r, pion(r), std::max(0.001, (1 - f) * avail - kMpi),
+                       ux, uy, uz, 0.4));
+  }
+  else if (ev.dis) {
+    int npi = 1 + r.Poisson(std::max(0.5, 2 * ev.w - 1.5));
+    if (r.Rndm() < 0.001) {
+      npi += r.Integer(100);  // Rare high-multiplicity tail
+    }
+    double share = avail / (npi + 1);
+    pre.push_back(make(r, nucleon, r.Exp(share), ux, uy, uz, 0.6));
+    for (int i=0; i<npi; i++) {
+      pre.push_back(make(r, pion(r), r.Exp(share), ux, uy, uz, 0.6));
+    }
+  }
+  else {
+    int pdg = (ev.nc ? 111 : nubar ? -211 : 211);
+    pre.push_back(make(r, pdg, std::max(0.001, avail - kMpi), ux, uy, uz, 0.05));
+    ev.t = r.Exp(0.01);
+  }
+
+  // Final state interactions: pion absorption and nucleon knockout
+  std::vector<Particle> post;
+  for (size_t i=0; i<pre.size(); i++) {
+    int apdg = abs(pre[i].pdg);
+    if ((apdg == 211 || apdg == 111) && r.Rndm() < 0.2) {
+      double ke = pre[i].e - mass(pre[i].pdg) + kMpi;
+      post.push_back(make(r, 2212, r.Uniform(0, ke), ux, uy, uz, 1.0));
+      post.push_back(make(r, 2112, r.Uniform(0, ke), ux, uy, uz, 1.0));
+    }
+    else {
+      post.push_back(pre[i]);
+    }
+  }
+  int nknock = (r.Rndm() < 0.4 ? 1 + r.Poisson(0.7) : 0);
+  for (int i=0; i<nknock; i++) {
+    int pdg = (r.Rndm() < 0.5 ? 2212 : 2112);
+    post.push_back(make(r, pdg, r.Exp(0.04), ux, uy, uz, 1.0));
+  }
+
+  store(pre, ev.ni, ev.pdgi, ev.ei, ev.pxi, ev.pyi, ev.pzi, ev.nip, ev.nin,
+        ev.nipip, ev.nipim, ev.nipi0, ev.nikp, ev.nikm, ev.nik0, ev.niem);
+  store(post, ev.nf, ev.pdgf, ev.ef, ev.pxf, ev.pyf, ev.pzf, ev.nfp, ev.nfn,
+        ev.nfpip, ev.nfpim, ev.nfpi0, ev.nfkp, ev.nfkm, ev.nfk0, ev.nfem);
+}
+
+
+/** Write one file of n events. */
+int write_file(std::string path, long n, unsigned seed) {
+  TFile f(path.c_str(), "recreate");
+  if (f.IsZombie()) {
+    std::cerr << "Cannot open " << path << std::endl;
+    return 1;
+  }
+
+  // Branches follow the Event bindings
+  Event ev(NULL);
+  TTree* t = new TTree("gst", "GENIE Summary Event Tree");
+  std::set<std::string> all;
+  all.insert("*");
+  ev.MakeBranches(t, all);
+
+  TRandom3 r(seed);
+  for (long i=0; i<n; i++) {
+    generate(r, ev);
+    t->Fill();
+  }
+
+  f.cd();
+  t->Write();
+  f.Close();
+  return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+  long nevents = 100000;
+  int nfiles = 1;
+  unsigned seed = 1;
+  std::string config = "Synthetic";
+  std::string gen = "Default+CCMEC";
+  std::string outdir;
+
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+      nevents = atol(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--files") == 0 && i + 1 < argc) {
+      nfiles = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      config = argv[++i];
+    }
+    else if (strcmp(argv[i], "--gen") == 0 && i + 1 < argc) {
+      gen = argv[++i];
+    }
+    else {
+      outdir = argv[i];
+    }
+  }
+
+  if (outdir == "" || nevents < 0 || nfiles < 1) {
+    std::cout << "Usage: " << argv[0] << " [--events N] [--files F] [--seed S] [--config NAME] [--gen NAME] OUTDIR" << std::endl;
+    return 0;
+  }
+
+  std::string dir = outdir + "/" + config + "_" + gen + "_" + std::to_string(seed);
+  mkdir(outdir.c_str(), 0755);
+  mkdir(dir.c_str(), 0755);
+  std::cout << "Output: " << dir << std::endl;
+
+  for (int i=0; i<nfiles; i++) {
+    long n = nevents * (i + 1) / nfiles - nevents * i / nfiles;
+    std::string path = dir + "/gntp." + std::to_string(i) + ".ghep.gst.root";
+    std::cout << "Writing " << path << " (" << n << " events)" << std::endl;
+    if (write_file(path, n, seed * 1000003u + i) != 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
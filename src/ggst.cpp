@@ -7,8 +7,22 @@
  * A. Mastbaum <mastbaum@uchicago.edu>, 2018/01/12
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 #include <TCanvas.h>
 #include <TChain.h>
 #include <TError.h>
@@ -23,40 +37,422 @@
 #include <TROOT.h>
 #include <TString.h>
 #include <TStyle.h>
+#include <TSystem.h>
 #include <TVector3.h>
 #include "event.h"
+#include "block.h"
+#include "memory.h"
+#include "prefetch.h"
 #include "hist.h"
+#include "universe.h"
+#include "sparse.h"
+#include "kernels.h"
+#include "plan.h"
+#include "planfile.h"
+#include "cache.h"
+#include "ledger.h"
+#include "index.h"
+#include "catalog.h"
+#include "skim.h"
+#include "preview.h"
+#include "profile.h"
 
-int ggst(std::vector<TString> files);
+/** Command-line options */
+struct Options {
+  Options() : nthreads(1), prune(true), cache(false), njobs(1), block(0),
+              render(true), incremental(false), watch(0), profile(false),
+              memory(false), universes(0), universeType(Universes::kPoisson),
+              seed(1), compact(false), prefetch(0), checkKernels(false),
+              fine(0), preview(0) {}
+  int nthreads;  //!< Number of event loop workers
+  bool prune;  //!< Read only the branches used by the booked histograms
+  bool cache;  //!< Input is a columnar cache (see cache.h)
+  TString makeCache;  //!< Convert the input to a cache in this directory
+  TString manifest;  //!< Run all samples listed in this file (see batch)
+  int njobs;  //!< Number of samples to run at once in batch mode
+  int block;  //!< Read and fill in blocks of this many events (0: per entry)
+  bool render;  //!< Draw canvases and PDFs (else use ggst-render later)
+  bool incremental;  //!< Add only new input files to a checkpoint
+  int watch;  //!< Rerun incrementally every this many seconds (0: once)
+  TString map;  //!< Write one partial output per input file to this directory
+  bool profile;  //!< Time the stages of the run, and write a report
+  TString plan;  //!< Analysis plan file (else kDefaultPlan)
+  bool memory;  //!< Read each worker's entries into memory before filling
+  int universes;  //!< Number of weight universes (see universe.h)
+  Universes::Type universeType;  //!< Kind of universe
+  unsigned seed;  //!< Seed for the universe weights and the preview sample
+  bool compact;  //!< Compact particle storage in blocks (see block.h)
+  int prefetch;  //!< Blocks to read ahead on a reader thread (0: none)
+  bool checkKernels;  //!< Compare batch kernels with the scalar getters
+  TString makeIndex;  //!< Write an event index for the input to this directory
+  TString index;  //!< Read only the entries this index selects (see index.h)
+  TString catalog;  //!< Input file catalog to use and update (see catalog.h)
+  TString skim;  //!< Write a skim of each selection to this directory (see skim.h)
+  int fine;  //!< Fine sparse copies, with this many cells per bin (0: none)
+  double preview;  //!< Stop once the histograms reach this precision (0: read all)
+};
 
+/** An input sample: a GENIE configuration and generator set */
+struct Sample {
+  Sample() : bytes(0) {}
+  TString config;
+  TString gen;
+  std::vector<TString> files;
+  TString output;  //!< Output file, if not ./<config>_<gen>.root
+  std::map<std::string, long> entries;  //!< Entries per file, from the catalog
+  std::map<std::string, double> branchBytes;  //!< Compressed bytes per branch, from the catalog
+  double bytes;  //!< Compressed bytes, from the catalog (0 if unknown)
+};
+
+int ggst(std::vector<TString> files, const Options& opts);
+
+int batch(TString manifest, const Options& opts);
+
+int run(const Sample& sample, const Options& opts);
+
+int runAll(const std::vector<Sample>& samples, const Options& opts);
+
+int catalog(std::vector<Sample>& samples, const Options& opts);
+
+/// Serializes output, since drawing and canvases are not thread safe
+std::mutex gOutputMutex;
 
-int main(int argc, char* argv[]) {
-  if (argc < 2) {
-    std::cout << "Usage: " << argv[0] << " \"files*.root\"" << std::endl;
-    return 0;
-  }
 
+int main(int argc, char* argv[]) {
   std::vector<TString> files;
+  Options opts;
+
   for (int i=1; i<argc; i++) {
-    files.push_back(argv[i]);
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      opts.nthreads = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--no-prune") == 0) {
+      opts.prune = false;
+    }
+    else if (strcmp(argv[i], "--cache") == 0) {
+      opts.cache = true;
+    }
+    else if (strcmp(argv[i], "--make-cache") == 0 && i + 1 < argc) {
+      opts.makeCache = argv[++i];
+    }
+    else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+      opts.manifest = argv[++i];
+    }
+    else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      opts.njobs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+      opts.block = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--no-render") == 0) {
+      opts.render = false;
+    }
+    else if (strcmp(argv[i], "--incremental") == 0) {
+      opts.incremental = true;
+    }
+    else if (strcmp(argv[i], "--plan") == 0 && i + 1 < argc) {
+      opts.plan = argv[++i];
+    }
+    else if (strcmp(argv[i], "--compact") == 0) {
+      opts.compact = true;
+    }
+    else if (strcmp(argv[i], "--make-index") == 0 && i + 1 < argc) {
+      opts.makeIndex = argv[++i];
+    }
+    else if (strcmp(argv[i], "--catalog") == 0 && i + 1 < argc) {
+      opts.catalog = argv[++i];
+    }
+    else if (strcmp(argv[i], "--fine") == 0 && i + 1 < argc) {
+      opts.fine = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--preview") == 0 && i + 1 < argc) {
+      opts.preview = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--skim") == 0 && i + 1 < argc) {
+      opts.skim = argv[++i];
+    }
+    else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+      opts.index = argv[++i];
+    }
+    else if (strcmp(argv[i], "--check-kernels") == 0) {
+      opts.checkKernels = true;
+    }
+    else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+      opts.prefetch = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--memory") == 0) {
+      opts.memory = true;
+    }
+    else if (strcmp(argv[i], "--universes") == 0 && i + 1 < argc) {
+      opts.universes = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--universe-weights") == 0 && i + 1 < argc) {
+      if (!Universes::ParseType(argv[++i], opts.universeType)) {
+        opts.universes = -1;
+      }
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      opts.seed = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--profile") == 0) {
+      opts.profile = true;
+    }
+    else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+      opts.map = argv[++i];
+    }
+    else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+      opts.incremental = true;
+      opts.watch = atoi(argv[++i]);
+    }
+    else {
+      files.push_back(argv[i]);
+    }
   }
 
-  return ggst(files);
-}
+  bool bad = ((files.empty() && opts.manifest == "") ||
+              opts.nthreads < 1 || opts.njobs < 1 || opts.block < 0 ||
+              opts.watch < 0 || opts.universes < 0 || opts.prefetch < 0 ||
+              opts.fine < 0 || opts.preview < 0);
+
+  // Modes that can't be combined
+  bool conflict = ((opts.incremental && (opts.cache || opts.makeCache != "" ||
+                                         opts.map != "")) ||
+                   (opts.map != "" && (opts.cache || opts.manifest != "")) ||
+                   (opts.memory && (opts.cache || opts.block > 0)) ||
+                   (opts.prefetch > 0 && (opts.cache || opts.memory)) ||
+                   (opts.universes > 0 && (opts.incremental || opts.map != "")) ||
+                   (opts.checkKernels && opts.block == 0) ||
+                   (opts.index != "" && (opts.cache || opts.block > 0 ||
+                                         opts.memory || opts.prefetch > 0)) ||
+                   (opts.catalog != "" && opts.cache) ||
+                   (opts.skim != "" && (opts.cache || opts.block > 0 ||
+                                        opts.memory || opts.prefetch > 0 ||
+                                        opts.map != "" || opts.incremental)) ||
+                   (opts.fine > 0 && (opts.incremental || opts.map != "")) ||
+                   (opts.preview > 0 && (opts.cache || opts.block > 0 ||
+                                         opts.memory || opts.prefetch > 0 ||
+                                         opts.index != "" || opts.skim != "" ||
+                                         opts.map != "" || opts.incremental)));
 
+  if (bad || conflict) {
+    std::cout << "Usage: " << argv[0] << " [--threads N] [--no-prune] [--block N [--check-kernels]] [--prefetch N] [--no-render] [--profile] [--plan FILE] \"files*.root\"" << std::endl;
+    std::cout << "       " << argv[0] << " --make-cache DIR \"files*.root\"" << std::endl;
+    std::cout << "       " << argv[0] << " [--threads N] --cache DIR/config_gen.gstc" << std::endl;
+    std::cout << "       " << argv[0] << " --make-index DIR \"files*.root\"" << std::endl;
+    std::cout << "       " << argv[0] << " [--threads N] --index DIR/config_gen.gsti \"files*.root\"" << std::endl;
+    std::cout << "       " << argv[0] << " [--plan FILE] [--index FILE] --skim DIR \"files*.root\"" << std::endl;
+    std::cout << "       " << argv[0] << " [--jobs N] [--threads N] --manifest samples.txt" << std::endl;
+    std::cout << "       " << argv[0] << " --catalog FILE ... (with any of the above, except --cache)" << std::endl;
+    std::cout << "       " << argv[0] << " [--memory] [--compact] [--universes N] [--universe-weights poisson|mode] [--seed S] ..." << std::endl;
+    std::cout << "       " << argv[0] << " [--fine K] ... (then ggst-rebin)" << std::endl;
+    std::cout << "       " << argv[0] << " [--seed S] --preview PRECISION \"files*.root\"" << std::endl;
+    std::cout << "       " << argv[0] << " [--jobs N] --map DIR \"files*.root\"" << std::endl;
+    std::cout << "       " << argv[0] << " [--incremental | --watch SECONDS] ... \"files*.root\"" << std::endl;
+    return 0;
+  }
 
-int ggst(std::vector<TString> files) {
   gROOT->SetBatch(true);
-  gROOT->ProcessLine(".x ~/.rootlogon.C");
+  if (opts.render) {
+    gROOT->ProcessLine(".x ~/.rootlogon.C");
+  }
   gStyle->SetOptStat(0);
   gErrorIgnoreLevel = kError;
 
+  // Histograms are written explicitly, so keep them (and the per-worker
+  // copies) out of the output directory
+  TH1::AddDirectory(false);
+
+  // With --watch, pick up new files as they arrive, until interrupted
+  while (true) {
+    int status = (opts.manifest != "" ? batch(opts.manifest, opts)
+                                      : ggst(files, opts));
+    if (opts.watch == 0) {
+      return status;
+    }
+    sleep(opts.watch);
+  }
+}
+
+
+/// Files opened at once when scanning for the catalog
+const int kScanThreads = 16;
+
+/// Use an index only if it selects at most this fraction of the entries
+const double kIndexMaxFraction = 0.5;
+
+
+/**
+ * The default analysis plan (see planfile.h), used without --plan.
+ *
+ * Books the inclusive and exclusive selections, and the CCMEC proton
+ * kinetic energies, so all come out of one pass over any sample.
+ */
+const char* kDefaultPlan = R"(
+selection all any
+selection ccqe CCQE
+selection ccmec CCMEC
+selection 1l1p 1l1p0pi0
+selection 1l1trk 1l1trk0pi0
+
+hist all q0q3 q0q3
+hist all nuanceCode nuanceCode
+hist all intmode intmode
+hist all nip number nip p
+hist all nin number nin n
+hist all nipip number nipip #pi^{+}
+hist all nipim number nipim #pi^{-}
+hist all nipi0 number nipi0 #pi^{0}
+hist all nikp number nikp K^{+}
+hist all nikm number nikm K^{-}
+hist all nik0 number nik0 K^{0}
+hist all nfp number nfp p, post-FSI
+hist all nfn number nfn n, post-FSI
+hist all nfpip number nfpip #pi^{+}, post-FSI
+hist all nfpim number nfpim #pi^{-}, post-FSI
+hist all nfpi0 number nfpi0 #pi^{0}, post-FSI
+hist all nfkp number nfkp K^{+}, post-FSI
+hist all nfkm number nfkm K^{-}, post-FSI
+hist all nfk0 number nfk0 K^{0}, post-FSI
+
+hist ccqe q0q3 q0q3
+hist ccqe tmu ke #mu
+hist ccqe ctmu cosTheta #mu
+hist ccqe tctmu Tct #mu
+
+hist ccmec q0q3 q0q3
+hist ccmec pke pKE
+hist ccmec leadpke leadpKE p_{lead}
+
+hist 1l1p q0q3 q0q3
+hist 1l1p nuanceCode nuanceCode
+hist 1l1p intmode intmode
+
+hist 1l1trk q0q3 q0q3
+hist 1l1trk nuanceCode nuanceCode
+hist 1l1trk intmode intmode
+)";
+
+
+/**
+ * Fill the booked histograms with entries [begin, end) of the tree.
+ *
+ * With a block size (opts.block), entries are read into an EventBlock block
+ * by block (compact, if requested) and filled through the block path, with
+ * the batch kernels checked against the scalar getters if requested;
+ * active is the set of branches read. With a list of entries (from an
+ * index, per-entry reading only), [begin, end) indexes into the list.
+ * A MemoryEvent reads the range into memory first, and a PrefetchEvent
+ * reads it ahead on another thread, so the read stage is the time spent
+ * waiting for data.
+ * If prof is not NULL, the read, select and fill stages are timed (per
+ * block, or for a sample of the entries, see Profile::kSample).
+ */
+void process(Event& ev, Booking& hists, long begin, long end,
+             const Options& opts, const std::set<std::string>& active,
+             const std::vector<long>* entries, Profile* prof) {
+  Plan plan(hists);
+
+  // Read this worker's entries into memory first, for an in-memory store
+  MemoryEvent* mem = dynamic_cast<MemoryEvent*>(&ev);
+  if (mem) {
+    Profile::Timer t(prof, Profile::kRead);
+    long n = mem->Fetch(begin, end);
+    std::ostringstream ss;
+    ss << "Memory: " << n << " entries, " << mem->Size() / 1e6 << " MB" << std::endl;
+    std::cout << ss.str();
+  }
+
+  // Or start reading ahead on a background thread
+  PrefetchEvent* pre = dynamic_cast<PrefetchEvent*>(&ev);
+  if (pre) {
+    pre->Start(begin, end);
+  }
+
+  if (opts.block == 0) {
+    // Time one entry in Profile::kSample, scaled up at the end
+    Profile sample;
+    long sampled = 0;
+    for (long i=begin; i<end; i++) {
+      Profile* p = NULL;
+      if (prof && (i - begin) % Profile::kSample == 0) {
+        p = &sample;
+        sampled++;
+      }
+
+      uint64_t mask;
+      {
+        Profile::Timer t(p, Profile::kRead);
+        ev.GetEntry(entries ? (*entries)[i] : i);
+      }
+      {
+        Profile::Timer t(p, Profile::kSelect);
+        mask = plan.Select(ev);
+      }
+      Profile::Timer t(p, Profile::kFill);
+      plan.Fill(ev, mask);
+    }
+
+    if (prof) {
+      prof->AddSampled(sample, sampled, end - begin);
+    }
+  }
+  else {
+    EventBlock b(ev, opts.block, opts.compact);
+    b.SetActive(active);
+    plan.Reserve(opts.block);
+    long mismatched = 0;
+
+    for (long i=begin; i<end; i+=b.n) {
+      {
+        Profile::Timer t(prof, Profile::kRead);
+        if (b.Read(i, end - i) == 0) {
+          std::cerr << "Failed to read entry " << i << std::endl;
+          break;
+        }
+      }
+      {
+        Profile::Timer t(prof, Profile::kSelect);
+        plan.SelectBlock(b);
+      }
+      if (opts.checkKernels) {
+        mismatched += plan.CheckBlock(b);
+      }
+      Profile::Timer t(prof, Profile::kFill);
+      plan.FillBlock(b);
+    }
+
+    if (opts.checkKernels) {
+      std::ostringstream ss;
+      ss << "Kernel check: " << mismatched << " of " << end - begin
+         << " events differ" << std::endl;
+      (mismatched ? std::cerr : std::cout) << ss.str();
+    }
+  }
+
+  if (pre) {
+    pre->Stop();
+  }
+
+  if (prof) {
+    size_t i = 0;
+    for (auto const& h : hists) {
+      prof->passed[h.first] += plan.passed[i++];
+    }
+    if (ev.gst || pre) {
+      prof->branches = ev.BranchBytes();
+    }
+  }
+}
+
+
+int ggst(std::vector<TString> files, const Options& opts) {
   assert(!files.empty());
 
   // Extract configuration name (FRAGILE!)
   TString dir, config, gen;
-  if (files.size() > 1) {
-    // Many files: use first file path
+  bool pattern = (files[0].Contains("*") || files[0].Contains("?"));
+  if (files.size() > 1 || pattern || opts.map != "") {
+    // Many files (a wildcard, or map mode): use first file path
     TObjArray* path = files[0].Tokenize("/");
     dir = ((TObjString*)(path->At(path->GetEntries()-2)))->GetString();
     TObjArray* conf = dir.Tokenize("_");
@@ -72,120 +468,719 @@ int ggst(std::vector<TString> files) {
     gen = ((TObjString*)(conf->At(1)))->GetString();
   }
   std::cout << "File: " << dir << std::endl;
+
+  // Map mode: one sample per input file, each written to a partial output
+  // for ggst-reduce, so a bad file costs only its own output
+  if (opts.map != "") {
+    std::vector<Sample> samples;
+    std::vector<TString> inputs = ExpandFiles(files);
+    for (size_t i=0; i<inputs.size(); i++) {
+      TString base = gSystem->BaseName(inputs[i]);
+      base.ReplaceAll(".root", "");
+      Sample sample;
+      sample.config = config;
+      sample.gen = gen;
+      sample.files.push_back(inputs[i]);
+      sample.output = opts.map + "/" + config + "_" + gen + "." + base + ".part.root";
+      samples.push_back(sample);
+    }
+    std::cout << "Inputs: " << samples.size() << std::endl;
+
+    int bad = 0;
+    if (opts.catalog != "") {
+      // Bad files are reported by the catalog, so drop their samples
+      bad = catalog(samples, opts);
+      if (bad < 0) {
+        return 1;
+      }
+      std::vector<Sample> good;
+      for (size_t i=0; i<samples.size(); i++) {
+        if (!samples[i].files.empty()) {
+          good.push_back(samples[i]);
+        }
+      }
+      samples.swap(good);
+    }
+
+    return (runAll(samples, opts) || bad > 0);
+  }
+
+  std::vector<Sample> samples(1);
+  samples[0].config = config;
+  samples[0].gen = gen;
+  samples[0].files = files;
+
+  if (opts.catalog != "" && catalog(samples, opts) < 0) {
+    return 1;
+  }
+
+  return run(samples[0], opts);
+}
+
+
+/**
+ * Run over all samples in a manifest, several at a time.
+ *
+ * Each line of the manifest lists a configuration, generator set and the
+ * input files (wildcards are allowed in the file names, as for TChain::Add):
+ *
+ *     DefaultPlusMECWithNC Default+CCMEC /path/DefaultPlusMECWithNC_Default+CCMEC_1234/gntp.*.ghep.gst.root
+ *
+ * Blank lines and lines starting with # are skipped. Output goes to the
+ * usual ./<config>_<gen>.root, as for a single sample.
+ */
+int batch(TString manifest, const Options& opts) {
+  std::vector<Sample> samples;
+  std::ifstream f(manifest.Data());
+  if (!f) {
+    std::cerr << "Cannot open manifest " << manifest << std::endl;
+    return 1;
+  }
+
+  std::string line;
+  while (std::getline(f, line)) {
+    std::istringstream ss(line);
+    std::string config, gen, file;
+    if (!(ss >> config) || config[0] == '#') {
+      continue;
+    }
+
+    Sample sample;
+    ss >> gen;
+    sample.config = config;
+    sample.gen = gen;
+    while (ss >> file) {
+      sample.files.push_back(file);
+    }
+
+    if (sample.files.empty()) {
+      std::cerr << "No files for " << config << "_" << gen << std::endl;
+      return 1;
+    }
+    samples.push_back(sample);
+  }
+  std::cout << "Samples: " << samples.size() << std::endl;
+
+  if (opts.catalog != "" && catalog(samples, opts) < 0) {
+    return 1;
+  }
+
+  return runAll(samples, opts);
+}
+
+
+/**
+ * Fill in the input files of each sample from the catalog (see catalog.h),
+ * scanning the files it doesn't have yet, in parallel, and saving it.
+ *
+ * Wildcards are expanded, and bad files are dropped with a message, so
+ * each sample lists only good files, with their entries and sizes.
+ * Returns the number of bad files, or -1 if the catalog can't be read.
+ */
+int catalog(std::vector<Sample>& samples, const Options& opts) {
+  Catalog cat;
+  if (!cat.Read(opts.catalog.Data())) {
+    return -1;
+  }
+
+  std::vector<std::vector<TString> > inputs(samples.size());
+  std::vector<TString> all;
+  for (size_t i=0; i<samples.size(); i++) {
+    inputs[i] = ExpandFiles(samples[i].files);
+    all.insert(all.end(), inputs[i].begin(), inputs[i].end());
+  }
+
+  size_t scanned = cat.Update(all, kScanThreads);
+  std::cout << "Catalog: " << all.size() << " files, " << scanned
+            << " scanned" << std::endl;
+  if (cat.changed && !cat.Write(opts.catalog.Data())) {
+    std::cerr << "Cannot write catalog " << opts.catalog << std::endl;
+  }
+
+  int bad = 0;
+  for (size_t i=0; i<samples.size(); i++) {
+    Sample& s = samples[i];
+    s.files.clear();
+    for (size_t j=0; j<inputs[i].size(); j++) {
+      std::string path = inputs[i][j].Data();
+      const FileInfo* info = cat.Find(path);
+      if (info->entries < 0) {
+        std::cerr << "Bad input file " << path << ": " << info->error << std::endl;
+        bad++;
+        continue;
+      }
+
+      s.files.push_back(path);
+      s.entries[path] = info->entries;
+      for (auto const& b : info->branches) {
+        s.branchBytes[b.first] += b.second.first;
+      }
+      s.bytes += info->Bytes();
+    }
+  }
+
+  return bad;
+}
+
+
+/** Run a list of samples, opts.njobs at a time, reporting any failures. */
+int runAll(const std::vector<Sample>& samples, const Options& opts) {
+  if (opts.njobs > 1 || opts.nthreads > 1) {
+    ROOT::EnableThreadSafety();
+  }
+
+  // Largest samples first (if their sizes are known from the catalog), so
+  // a big one doesn't start last and hold up the end of the run
+  std::vector<size_t> order(samples.size());
+  for (size_t i=0; i<order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return samples[a].bytes > samples[b].bytes;
+  });
+
+  // Worker pool: each job takes the next sample in the list
+  std::atomic<size_t> next(0);
+  std::vector<int> status(samples.size(), 0);
+  auto worker = [&]() {
+    for (size_t i=next++; i<samples.size(); i=next++) {
+      status[order[i]] = run(samples[order[i]], opts);
+    }
+  };
+
+  std::vector<std::thread> jobs;
+  for (int i=0; i<opts.njobs; i++) {
+    jobs.push_back(std::thread(worker));
+  }
+  for (size_t i=0; i<jobs.size(); i++) {
+    jobs[i].join();
+  }
+
+  int failed = 0;
+  for (size_t i=0; i<samples.size(); i++) {
+    if (status[i] != 0) {
+      if (samples[i].output != "") {
+        std::cerr << "Failed: " << samples[i].files[0] << std::endl;
+      }
+      else {
+        std::cerr << "Failed: " << samples[i].config << "_" << samples[i].gen << std::endl;
+      }
+      failed++;
+    }
+  }
+
+  if (failed > 0) {
+    std::cerr << failed << " of " << samples.size() << " failed" << std::endl;
+  }
+
+  return (failed > 0);
+}
+
+
+/**
+ * Fill and write the histograms for one sample.
+ *
+ * In incremental mode, the histograms so far are kept in a checkpoint,
+ * ./<config>_<gen>.ckpt.root, along with a ledger of the files they
+ * include. Only files not in the ledger are read, and their histograms are
+ * added to the checkpoint's before writing.
+ */
+int run(const Sample& sample, const Options& opts) {
+  int nthreads = opts.nthreads;
+  std::vector<TString> files = sample.files;
+  TString config = sample.config;
+  TString gen = sample.gen;
+
   std::cout << "Configuration: " << config << std::endl;
   std::cout << "Generators: " << gen << std::endl;
 
-  // Set up input ROOT trees
-  TChain* gst = new TChain("gst");
-  for (size_t i=0; i<files.size(); i++) {
-    std::cout << "Add: " << files[i] << std::endl;
-    gst->Add(files[i]);
+  if (files.empty()) {
+    std::cerr << "No input files" << std::endl;
+    return 1;
   }
-  std::cout << "Entries: " << gst->GetEntries() << std::endl;
-  Event ev(gst);
 
-  // Output file and histograms
-  TString outpath = TString("./") + config + "_" + gen + ".root";
-  TFile* fout = TFile::Open(outpath, "recreate");
+  // Load the checkpoint, and drop the files it already includes
+  TString ckptpath = TString("./") + config + "_" + gen + ".ckpt.root";
+  TFile* ckpt = NULL;
+  Ledger ledger;
+  if (opts.incremental) {
+    if (Stamp(ckptpath.Data()).size >= 0) {
+      ckpt = TFile::Open(ckptpath);
+      TObjString* text = ckpt ? (TObjString*) ckpt->Get("ledger") : NULL;
+      if (!text) {
+        std::cerr << "Cannot read checkpoint " << ckptpath << std::endl;
+        delete ckpt;
+        return 1;
+      }
+      ledger = Ledger(text->GetString().Data());
+      delete text;
+    }
+
+    files = ledger.Select(ExpandFiles(sample.files));
+    std::cout << "Checkpoint: " << ledger.size() << " files, "
+              << files.size() << " new" << std::endl;
 
-  // Book histograms.
-  // The mapping is {"selection": [selection_function, {"histname": hist}]}
-  std::map<std::string, std::pair<Event::EventType, std::map<std::string, Hist*> > > hists;
+    if (files.empty()) {
+      delete ckpt;
+      return 0;
+    }
+  }
 
-  if (gen == "CCMEC") {
-    hists = {
-      {
-        "ccmec", {
-          Event::isCCMEC, {
-            {"q0q3", new Hist_q0q3("h_ccmec_q0q3")},
-            {"pke", new Hist_pKE("h_ccmec_pke")},
-            {"leadpke", new Hist_leadpKE("h_ccmec_leadpke", "p_{lead}")}
-          }
+  // Inputs, events and histograms, freed by done() on every return, since
+  // batch mode runs many samples in one process
+  std::vector<TChain*> chains;
+  std::vector<Event*> events;
+  std::vector<Booking> workers;
+  std::vector<Universes*> universes;
+  auto done = [&](int status) {
+    for (size_t i=0; i<workers.size(); i++) {
+      for (auto const& h : workers[i]) {
+        for (auto const& hist : h.second.second) {
+          delete hist.second;
         }
       }
-    };
+    }
+    for (size_t i=0; i<events.size(); i++) {
+      delete events[i];
+    }
+    for (size_t i=0; i<universes.size(); i++) {
+      delete universes[i];
+    }
+    for (size_t i=0; i<chains.size(); i++) {
+      delete chains[i];
+    }
+    if (ckpt) {
+      ckpt->Close();
+      delete ckpt;
+    }
+    return status;
+  };
+
+  // A partial output needs a readable input: check it up front, since a
+  // TChain silently skips files it can't open (files in the catalog have
+  // been checked already)
+  if (sample.output != "" && !sample.entries.count(files[0].Data())) {
+    TFile* f = TFile::Open(files[0]);
+    bool ok = (f && !f->IsZombie() && !f->TestBit(TFile::kRecovered) &&
+               dynamic_cast<TTree*>(f->Get("gst")));
+    delete f;
+    if (!ok) {
+      std::cerr << "Bad input file " << files[0] << std::endl;
+      return done(1);
+    }
+  }
+
+  // Profiling: one Profile per worker, added up after the loop
+  Profile total;
+  Profile* prof = (opts.profile ? &total : NULL);
+  std::vector<Profile> profiles(nthreads);
+  double fileBytes0 = TFile::GetFileBytesRead();
+  double wall0 = Profile::Wall(), cpu0 = Profile::CPU();
+
+  // Set up input ROOT trees, one chain per worker. With entry counts from
+  // the catalog, files aren't opened until the loop reaches them.
+  for (int i=0; i<(opts.cache ? 0 : nthreads); i++) {
+    TChain* gst = new TChain("gst");
+    for (size_t j=0; j<files.size(); j++) {
+      if (i == 0) {
+        std::cout << "Add: " << files[j] << std::endl;
+      }
+      std::map<std::string, long>::const_iterator n = sample.entries.find(files[j].Data());
+      if (n == sample.entries.end()) {
+        gst->Add(files[j]);
+      }
+      else if (n->second > 0) {
+        gst->Add(files[j], n->second);
+      }
+    }
+    chains.push_back(gst);
+  }
+
+  // Convert to a columnar cache, and stop there
+  if (opts.makeCache != "") {
+    Event ev(chains[0]);
+    std::string cachepath = std::string(opts.makeCache) + "/" + config.Data() + "_" + gen.Data() + ".gstc";
+    std::cout << "Cache: " << cachepath << std::endl;
+    long n = WriteCache(ev, cachepath);
+    std::cout << "Entries: " << n << std::endl;
+    return done(n < 0);
+  }
+
+  // Build an event index, and stop there
+  if (opts.makeIndex != "") {
+    Event ev(chains[0]);
+    std::string indexpath = std::string(opts.makeIndex) + "/" + config.Data() + "_" + gen.Data() + ".gsti";
+    std::cout << "Index: " << indexpath << std::endl;
+    long n = EventIndex::Write(ev, ExpandFiles(files), indexpath);
+    std::cout << "Entries: " << n << std::endl;
+    return done(n < 0);
+  }
+
+  // Skims carry their Features, which plain per-entry reading picks up
+  bool skim = (!opts.cache && !opts.memory && opts.prefetch == 0 &&
+               opts.block == 0 && SkimEvent::IsSkim(chains[0]));
+  if (skim) {
+    std::cout << "Skim: reading stored Features" << std::endl;
+  }
+
+  // Prefetching reads on a thread of its own, even with one worker
+  if (opts.prefetch > 0) {
+    ROOT::EnableThreadSafety();
+  }
+
+  for (int i=0; i<nthreads; i++) {
+    if (opts.cache) {
+      CacheEvent* ce = new CacheEvent(files[0].Data());
+      if (!ce->IsOpen()) {
+        delete ce;
+        return done(1);
+      }
+      events.push_back(ce);
+    }
+    else if (opts.memory) {
+      events.push_back(new MemoryEvent(chains[i], opts.compact));
+    }
+    else if (opts.prefetch > 0) {
+      events.push_back(new PrefetchEvent(chains[i], opts.prefetch));
+    }
+    else if (skim) {
+      events.push_back(new SkimEvent(chains[i]));
+    }
+    else {
+      events.push_back(new Event(chains[i]));
+    }
+  }
+
+  long nentries = events[0]->GetEntries();
+  std::cout << "Entries: " << nentries << std::endl;
+
+  if (prof) {
+    prof->Stop(Profile::kOpen, wall0, cpu0);
+  }
+
+  // Histograms, booked from the plan
+  std::string plan = kDefaultPlan;
+  if (opts.plan != "") {
+    std::ifstream fplan(opts.plan.Data());
+    std::stringstream ss;
+    ss << fplan.rdbuf();
+    if (!fplan) {
+      std::cerr << "Cannot read plan " << opts.plan << std::endl;
+      return done(1);
+    }
+    plan = ss.str();
+  }
+
+  workers.resize(nthreads);
+  universes.resize(nthreads, NULL);
+  for (int i=0; i<nthreads; i++) {
+    if (opts.universes > 0) {
+      universes[i] = new Universes(opts.universes, opts.universeType, opts.seed);
+    }
+    if (!ReadPlan(*events[i], plan, workers[i], universes[i], opts.fine)) {
+      return done(1);
+    }
+  }
+
+  // Turn off the branches no selection or histogram reads
+  std::set<std::string> branches;
+  if (!opts.prune) {
+    branches.insert("*");
   }
   else {
-    hists = {
-      {
-        "all", {
-          Event::isAny, {
-            {"q0q3", new Hist_q0q3("h_all_q0q3")},
-            {"nuanceCode", new Hist_nuanceCode("h_all_nuanceCode")},
-            {"intMode", new Hist_intmode("h_all_intmode")},
-            {"nip", new Hist_number("h_all_nip", "p", &ev.nip)},
-            {"nin", new Hist_number("h_all_nin", "n", &ev.nin)},
-            {"nipip", new Hist_number("h_all_nipip", "#pi^{+}", &ev.nipip)},
-            {"nipim", new Hist_number("h_all_nipim", "#pi^{-}", &ev.nipim)},
-            {"nipi0", new Hist_number("h_all_nipi0", "#pi^{0}", &ev.nipi0)},
-            {"nikp", new Hist_number("h_all_nikp", "K^{+}", &ev.nikp)},
-            {"nikm", new Hist_number("h_all_nikm", "K^{-}", &ev.nikm)},
-            {"nik0", new Hist_number("h_all_nik0", "K^{0}", &ev.nik0)},
-            {"nfp", new Hist_number("h_all_nfp", "p, post-FSI", &ev.nfp)},
-            {"nfn", new Hist_number("h_all_nfn", "n, post-FSI", &ev.nfn)},
-            {"nfpip", new Hist_number("h_all_nfpip", "#pi^{+}, post-FSI", &ev.nfpip)},
-            {"nfpim", new Hist_number("h_all_nfpim", "#pi^{-}, post-FSI", &ev.nfpim)},
-            {"nfpi0", new Hist_number("h_all_nfpi0", "#pi^{0}, post-FSI", &ev.nfpi0)},
-            {"nfkp", new Hist_number("h_all_nfkp", "K^{+}, post-FSI", &ev.nfkp)},
-            {"nfkm", new Hist_number("h_all_nfkm", "K^{-}, post-FSI", &ev.nfkm)},
-            {"nfk0", new Hist_number("h_all_nfk0", "K^{0}, post-FSI", &ev.nfk0)}
-          }
-        },
-      },
-      {
-        "ccqe", {
-          Event::isCCQE, {
-            {"q0q3", new Hist_q0q3("h_ccqe_q0q3")},
-            {"tmu", new Hist_ke("h_ccqe_tmu", "#mu")},
-            {"ctmu", new Hist_cosTheta("h_ccqe_ctmu", "#mu")},
-            {"tctmu", new Hist_Tct("h_ccqe_tctmu", "#mu")},
-          }
-        },
-      },
-      {
-        "1l1p", {
-          Event::is1l1p0pi0, {
-            {"q0q3", new Hist_q0q3("h_1l1p_q0q3")},
-            {"nuanceCode", new Hist_nuanceCode("h_1l1p_nuanceCode")},
-            {"intMode", new Hist_intmode("h_1l1p_intmode")}
-          }
-        },
-      },
-      {
-        "1l1trk", {
-          Event::is1l1trk0pi0, {
-            {"q0q3", new Hist_q0q3("h_1l1trk_q0q3")},
-            {"nuanceCode", new Hist_nuanceCode("h_1l1trk_nuanceCode")},
-            {"intMode", new Hist_intmode("h_1l1trk_intmode")}
-          }
-        },
+    for (auto const& h : workers[0]) {
+      Event::Branches(h.second.first, branches);
+      for (auto const& hist : h.second.second) {
+        hist.second->Branches(*events[0], branches);
+      }
+    }
+
+    std::cout << "Branches:";
+    for (auto const& b : branches) {
+      std::cout << " " << b;
+    }
+    std::cout << std::endl;
+
+    for (int i=0; i<nthreads; i++) {
+      events[i]->SetActive(branches);
+    }
+  }
+
+  if (sample.bytes > 0) {
+    double active = 0;
+    for (auto const& b : sample.branchBytes) {
+      if (branches.count("*") || branches.count(b.first)) {
+        active += b.second;
       }
-    };
+    }
+    std::cout << "Catalog: " << active / 1e6 << " MB of " << sample.bytes / 1e6
+              << " MB compressed to read" << std::endl;
   }
 
-  // Event Loop
-  for (int i=0; i<ev.GetEntries(); i++) {
-    ev.GetEntry(i);
+  // With an up-to-date index and narrow enough selections, loop over only
+  // the entries that can pass
+  std::vector<long> indexed;
+  const std::vector<long>* entries = NULL;
+  if (opts.index != "") {
+    std::vector<Event::EventType> sels;
+    for (auto const& h : workers[0]) {
+      sels.push_back(h.second.first);
+    }
 
-    // Loop over "selections"
-    for (auto const& h : hists) {
-      if ((*h.second.first)(ev)) {
-        // Loop over histograms for this selection
-        for (auto const& hist : h.second.second) {
-          hist.second->Fill(ev);
+    EventIndex index;
+    if (!index.Read(opts.index.Data())) {
+      return done(1);
+    }
+    else if (!index.Matches(ExpandFiles(files)) ||
+             (long) index.records.size() != nentries) {
+      std::cerr << "Index: " << opts.index << " is out of date, reading all entries" << std::endl;
+    }
+    else if (!index.Select(sels, indexed)) {
+      std::cout << "Index: selections can't be indexed, reading all entries" << std::endl;
+    }
+    else if (indexed.size() > kIndexMaxFraction * nentries) {
+      std::cout << "Index: " << indexed.size() << " entries selected, reading all entries" << std::endl;
+    }
+    else {
+      std::cout << "Index: reading " << indexed.size() << " of " << nentries << " entries" << std::endl;
+      entries = &indexed;
+    }
+  }
+  long nloop = (entries ? (long) entries->size() : nentries);
+
+  // Write a skim of each selection, and stop there
+  if (opts.skim != "") {
+    std::string name = std::string(config.Data()) + "_" + gen.Data();
+    long n = WriteSkims(*events[0], workers[0], opts.skim.Data(), name,
+                        entries, nloop);
+    std::cout << "Entries: " << n << std::endl;
+    return done(n < 0);
+  }
+
+  // Event Loop: run the workers over n entries (of list, if not NULL)
+  double loop0 = Profile::Wall();
+  auto loop = [&](long n, const std::vector<long>* list) {
+    if (nthreads == 1) {
+      process(*events[0], workers[0], 0, n, opts, branches, list,
+              prof ? &profiles[0] : NULL);
+      return;
+    }
+
+    // Split the entry range into contiguous blocks, one per worker
+    ROOT::EnableThreadSafety();
+    std::vector<std::thread> threads;
+    for (int i=0; i<nthreads; i++) {
+      long begin = n * i / nthreads;
+      long end = n * (i + 1) / nthreads;
+      threads.push_back(std::thread(process, std::ref(*events[i]),
+                                    std::ref(workers[i]), begin, end,
+                                    std::cref(opts), std::cref(branches),
+                                    list, prof ? &profiles[i] : NULL));
+    }
+    for (size_t i=0; i<threads.size(); i++) {
+      threads[i].join();
+    }
+  };
+
+  // A preview reads rounds of random chunks until the histograms are
+  // precise enough (see preview.h), or everything has been read
+  long nread = nloop;
+  double precision = -1;
+  std::vector<std::string> rare;
+  if (opts.preview > 0) {
+    std::vector<std::pair<long, long> > chunks =
+      PreviewChunks(chains[0], kPreviewChunk, opts.seed);
+    std::vector<long> round;
+    size_t next = 0;
+    nread = 0;
+    for (int rounds=1; next<chunks.size(); rounds++) {
+      round.clear();
+      long size = std::max(kPreviewRound, nread / 4);
+      for (; next<chunks.size() && (long) round.size()<size; next++) {
+        for (long i=chunks[next].first; i<chunks[next].second; i++) {
+          round.push_back(i);
+        }
+      }
+      std::sort(round.begin(), round.end());
+      loop(round.size(), &round);
+      nread += round.size();
+
+      std::string worst;
+      rare.clear();
+      precision = PreviewPrecision(workers, rounds >= kPreviewMinRounds,
+                                   worst, rare);
+      std::cout << "Preview: " << nread << " of " << nentries << " entries ("
+                << 100.0 * nread / std::max(nentries, 1L) << "%), precision ";
+      if (std::isinf(precision)) {
+        std::cout << "- (" << worst << " has fewer than "
+                  << kPreviewMinEntries << " entries)" << std::endl;
+      }
+      else if (worst == "") {
+        std::cout << "- (no histogram has enough entries)" << std::endl;
+      }
+      else {
+        std::cout << precision << " (" << worst << ")" << std::endl;
+      }
+      if (!rare.empty()) {
+        std::cout << "Preview: left out, with fewer than "
+                  << kPreviewMinEntries << " entries:";
+        for (size_t i=0; i<rare.size(); i++) {
+          std::cout << " " << rare[i];
+        }
+        std::cout << std::endl;
+      }
+      if (precision <= opts.preview) {
+        break;
+      }
+    }
+  }
+  else {
+    loop(nloop, entries);
+  }
+
+  // Merge into the first worker's histograms, in worker order
+  for (int i=1; i<nthreads; i++) {
+    for (auto& h : workers[0]) {
+      for (auto& hist : h.second.second) {
+        hist.second->Add(workers[i][h.first].second[hist.first]);
+      }
+    }
+  }
+
+  Booking& hists = workers[0];
+
+  if (prof) {
+    total.loop = Profile::Wall() - loop0;
+    total.entries = nread;
+    for (int i=0; i<nthreads; i++) {
+      total.Add(profiles[i]);
+    }
+  }
+
+  if (ckpt) {
+    for (auto& h : hists) {
+      for (auto& hist : h.second.second) {
+        TH1* saved = (TH1*) ckpt->Get(hist.second->h->GetName());
+        if (saved) {
+          hist.second->Merge(saved);
+          delete saved;
         }
       }
     }
+    ckpt->Close();
+    delete ckpt;
+    ckpt = NULL;
+  }
+
+  double zipRead = 0, zipTotal = 0;
+  for (int i=0; i<nthreads; i++) {
+    zipRead += events[i]->zipRead;
+    zipTotal += events[i]->zipTotal;
   }
+  std::cout << "Read " << zipRead / 1e6 << " MB of "
+            << zipTotal / 1e6 << " MB compressed (all branches)" << std::endl;
 
   // Output
-  for (auto const& h : hists) {
-    for (auto const& hist : h.second.second) {
-      std::cout << "Writing " << h.first << " " << hist.first << std::endl;
-      hist.second->Write(config, gen, fout);
+  {
+    std::lock_guard<std::mutex> lock(gOutputMutex);
+
+    // Save the new checkpoint, replacing the old one only once complete
+    if (opts.incremental) {
+      TString tmppath = ckptpath + ".tmp";
+      TFile* fckpt = TFile::Open(tmppath, "recreate");
+      if (!fckpt || fckpt->IsZombie()) {
+        std::cerr << "Cannot open " << tmppath << std::endl;
+        delete fckpt;
+        return done(1);
+      }
+
+      for (auto const& h : hists) {
+        for (auto const& hist : h.second.second) {
+          hist.second->Write(config, gen, fckpt, false);
+        }
+      }
+
+      ledger.Commit();
+      TObjString text(ledger.Text().c_str());
+      fckpt->WriteTObject(&text, "ledger");
+      fckpt->Close();
+      delete fckpt;
+
+      if (rename(tmppath.Data(), ckptpath.Data()) != 0) {
+        std::cerr << "Cannot replace " << ckptpath << std::endl;
+        return done(1);
+      }
+    }
+
+    TString outpath = TString("./") + config + "_" + gen +
+                      (opts.preview > 0 ? ".preview.root" : ".root");
+    if (sample.output != "") {
+      outpath = sample.output;
+    }
+    TFile* fout = TFile::Open(outpath, "recreate");
+    if (!fout || fout->IsZombie()) {
+      std::cerr << "Cannot open " << outpath << std::endl;
+      delete fout;
+      return done(1);
+    }
+
+    // Partial outputs are rendered after the reduce step
+    bool render = opts.render && sample.output == "";
+    for (auto const& h : hists) {
+      for (auto const& hist : h.second.second) {
+        std::cout << "Writing " << h.first << " " << hist.first << std::endl;
+        {
+          Profile::Timer t(prof, Profile::kWrite);
+          hist.second->Write(config, gen, fout, false);
+        }
+        if (render) {
+          Profile::Timer t(prof, Profile::kRender);
+          Render(hist.second->h, config, gen, fout);
+        }
+        if (prof) {
+          total.filled[h.first + "/" + hist.first] = hist.second->h->GetEntries();
+        }
+      }
+    }
+
+    // Tag partial outputs with their sample, for ggst-reduce
+    if (sample.output != "") {
+      TObjString tag(config + " " + gen);
+      fout->WriteTObject(&tag, "sample");
+    }
+
+    // Tag previews with the entries read, the scale to the full sample,
+    // the precision reached (-1 if a histogram had too few entries) and
+    // the histograms left out
+    if (opts.preview > 0) {
+      std::ostringstream ss;
+      ss << nread << " " << nentries << " "
+         << (nread > 0 ? 1.0 * nentries / nread : 0) << " "
+         << (std::isinf(precision) ? -1 : precision);
+      for (size_t i=0; i<rare.size(); i++) {
+        ss << " " << rare[i];
+      }
+      TObjString tag(ss.str().c_str());
+      fout->WriteTObject(&tag, "preview");
+    }
+
+    fout->Close();
+    delete fout;
+
+    if (prof) {
+      // Bytes read by all files open in this process, in batch mode
+      total.fileBytes = TFile::GetFileBytesRead() - fileBytes0;
+      total.Print(std::cout);
+
+      TString jsonpath = outpath;
+      jsonpath.ReplaceAll(".root", ".profile.json");
+      std::cout << "Profile: " << jsonpath << std::endl;
+      if (!total.WriteJSON(jsonpath.Data())) {
+        std::cerr << "Cannot write " << jsonpath << std::endl;
+      }
     }
   }
 
-  return 0;
+  return done(0);
 }
 
@@ -4,266 +4,402 @@
  */
 
 #include <iostream>
-#include <TCanvas.h>
-#include <TF1.h>
+#include <set>
+#include <string>
 #include <TFile.h>
 #include <TH1D.h>
 #include <TH2D.h>
-#include <TPaveText.h>
 #include <TString.h>
-#include <TStyle.h>
 #include <TVector3.h>
-
-/** Create a TPaveText label with information about the GENIE config. */
-TPaveText* genie_label(TString config, TString gen) {
-    TPaveText* l = new TPaveText(0.17, 0.6, 0.62, 0.88, "ndc");
-    l->SetTextFont(132);
-    l->SetTextAlign(12);
-    l->SetBorderSize(0);
-    l->SetFillColor(0);
-    l->SetFillStyle(0);
-    l->AddText("GENIE 2.12.10, BNB #nu_{#mu}");
-    l->AddText(config);
-    l->AddText(TString("Generators: ") + gen);
-    return l;
-}
-
+#include "bins.h"
+#include "render.h"
 
 class Hist {
 public:
   Hist(TH1* _h) : h(_h) {}
 
-  virtual void Fill(Event& ev) = 0;
+  virtual ~Hist() { delete h; }
 
-  virtual void Write(TString config, TString gen, TFile* f, bool lines=false, bool label=false) {
-    char cname[150];
-    snprintf(cname, 150, "c_%s", h->GetName());
-    TCanvas* c = new TCanvas();
-    c->SetName(cname);
-    c->SetLeftMargin(0.15);
-    h->Draw("colz");
-
-    TPaveText* l1 = NULL;
-    TPaveText* l2 = NULL;
-    std::vector<TF1*> qfs, wfs;
-    if (std::string(h->GetName()).find("q0q3") != std::string::npos) {
-      // Labels
-      l1 = genie_label(config, gen);
-      l1->AddText("Lines W = 938, 1232, 1535 MeV");
-      l1->AddText("Lines Q^{2} = 0.2 - 1.0 GeV");
-      l1->Draw();
-
-      // Q2 and W lines
-      float lw = 2;
-      std::vector<float> qs = {200, 400, 600, 800, 1000};
-      for (size_t j=0; j<qs.size(); j++) {
-        char fname[150];
-        snprintf(fname, 150, "fq_%f", qs[j]);
-        char ff[350];
-        snprintf(ff, 350, "sqrt(TMath::Max(x**2-%f, 0.0))", qs[j]/1000);
-        TF1* f = new TF1(fname, ff, qs[j]/1000, 1.3);
-        f->SetNpx(1000);
-        f->SetLineColor(kWhite);
-        f->SetLineWidth(lw);
-        f->Draw("same");
-        qfs.push_back(f);
-      }
+  virtual void Fill(Event& ev) = 0;
 
-      std::vector<float> ws = {0.938, 1.232, 1.535};
-      for (size_t j=0; j<ws.size(); j++) {
-        char fname[150];
-        snprintf(fname, 150, "fw_%f", qs[j]);
-        char ff[350];
-        snprintf(ff, 350, "sqrt(%f**2 + x**2) - 0.938", ws[j]);
-        TF1* f = new TF1(fname, ff, 0, 1.3);
-        f->SetNpx(1000);
-        f->SetLineColor(kWhite);
-        f->SetLineWidth(lw);
-        f->Draw("same");
-        qfs.push_back(f);
-      }
-    }
-    else if (label) {
-      l2 = genie_label(config, gen);
-      l2->Draw();
+  /**
+   * Fill with events idx[0..n) of a block.
+   *
+   * By default each event is loaded back into the block's Event for Fill;
+   * histograms of plain columns override this to fill from the buffers.
+   */
+  virtual void FillBlock(EventBlock& b, const uint32_t* idx, size_t n) {
+    for (size_t k=0; k<n; k++) {
+      b.Load(idx[k]);
+      Fill(b.ev);
+      b.Keep(idx[k]);
     }
+  }
+
+  /** Add the names of the branches read by Fill to b. */
+  virtual void Branches(Event& ev, std::set<std::string>& b) = 0;
+
+  /** Merge in the contents of another copy of this histogram. */
+  virtual void Add(Hist* other) { h->Add(other->h); }
+
+  /** Merge in the contents of a saved copy of this histogram. */
+  virtual void Merge(const TH1* saved) { h->Add(saved); }
+
+  /** Copy natively accumulated contents into h. */
+  virtual void Flush() {}
+
+  /** Write the histogram to f, and draw it there unless render is false. */
+  virtual void Write(TString config, TString gen, TFile* f, bool render=true) {
+    Flush();
 
-    c->RedrawAxis();
-    c->Update();
     f->cd();
     h->Write();
-    c->Write();
-    c->SaveAs(TString("./") + config + "_" + gen + "_" + cname + ".pdf"); 
+
+    if (render) {
+      Render(h, config, gen, f);
+    }
   }
 
   TH1* h;
 };
 
 
-class Hist_q0q3 : public Hist {
+/**
+ * A histogram filled through a native 1D binning (see bins.h), and copied
+ * into a ROOT histogram of type H on write.
+ */
+template<class X, class H=TH1D>
+class Hist1 : public Hist {
+public:
+  Hist1(TString name, TString title)
+    : Hist(new H(name, title, X::nbins, X::min(), X::max())) {}
+
+  void Add(Hist* other) { bins.Add(((Hist1*) other)->bins); }
+
+  void Merge(const TH1* saved) { bins.Add(saved); }
+
+  void Flush() { bins.Copy(h); }
+
+  typedef Bins1<X> BinsType;
+  BinsType bins;
+};
+
+
+/** A histogram filled through a native 2D binning, written as a TH2D. */
+template<class X, class Y>
+class Hist2 : public Hist {
 public:
-  Hist_q0q3(TString name) : Hist(
-    new TH2D(name,
-             ";Three-momentum transfer q^{3} (GeV);Energy transfer q^{0} (GeV)",
-             100, 0, 1.250, 100, 0, 1.250)) {}
+  Hist2(TString name, TString title)
+    : Hist(new TH2D(name, title, X::nbins, X::min(), X::max(),
+                    Y::nbins, Y::min(), Y::max())) {}
+
+  void Add(Hist* other) { bins.Add(((Hist2*) other)->bins); }
+
+  void Merge(const TH1* saved) { bins.Add(saved); }
+
+  void Flush() { bins.Copy(h); }
+
+  typedef Bins2<X, Y> BinsType;
+  BinsType bins;
+};
+
+
+/// Binnings
+typedef Axis<100, 0, 1250> AxisQ;  // q0, q3 (GeV)
+typedef Axis<100, 0, 100, 1> AxisNuance;
+typedef Axis<21, 0, 21, 1> AxisNumber;
+typedef Axis<11, 0, 11, 1> AxisMode;
+typedef Axis<200, 0, 3500> AxisKE;
+typedef Axis<100, 0, 3500> AxisKE2D;
+typedef Axis<100, -1, 1, 1> AxisCosTheta;
+typedef Axis<200, 0, 1000> AxisLeadpKE;
+typedef Axis<100, 0, 1000> AxispKE;
+
+
+class Hist_q0q3 : public Hist2<AxisQ, AxisQ> {
+public:
+  Hist_q0q3(TString name) : Hist2(
+    name,
+    ";Three-momentum transfer q^{3} (GeV);Energy transfer q^{0} (GeV)") {}
  
+  int Cell(Event& ev) {
+    return bins.Cell(ev.q3(), ev.q0());
+  }
+
+  bool Coords(Event& ev, double* v) {
+    v[0] = ev.q3();
+    v[1] = ev.q0();
+    return true;
+  }
+
   void Fill(Event& ev) {
-    h->Fill(ev.q3(), ev.q0());
+    bins.Fill(ev.q3(), ev.q0());
   }
 
-  void Write(TString config, TString gen, TFile* f) {
-    Hist::Write(config, gen, f, true);
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, Event::q0Branches());
+    Event::Need(b, Event::q3Branches());
   }
 };
 
 
-class Hist_nuanceCode : public Hist {
+class Hist_nuanceCode : public Hist1<AxisNuance> {
 public:
-  Hist_nuanceCode(TString name) : Hist(
-    new TH1D(name,
-             ";NUANCE interaction code;Entries",
-             100, 0, 100)) {}
+  Hist_nuanceCode(TString name) : Hist1(
+    name,
+    ";NUANCE interaction code;Entries") {}
 
   void Fill(Event& ev) {
-    h->Fill(ev.nuance_code);
+    bins.Fill(ev.nuance_code);
+  }
+
+  void FillBlock(EventBlock& b, const uint32_t* idx, size_t n) {
+    const int* col = b.Column<int>("nuance_code");
+    if (!col) {
+      return Hist::FillBlock(b, idx, n);
+    }
+
+    for (size_t k=0; k<n; k++) {
+      bins.Fill(col[idx[k]]);
+    }
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    b.insert("nuance_code");
   }
 };
 
 
-class Hist_number : public Hist {
+class Hist_number : public Hist1<AxisNumber> {
 public:
-  Hist_number(TString name, TString title, int* _number) : Hist(
-    new TH1D(name,
-             TString(";Number of ") + title + ";Entries",
-             21, 0, 21)), number(_number) {}
+  Hist_number(TString name, TString title, int* _number) : Hist1(
+    name,
+    TString(";Number of ") + title + ";Entries"), number(_number) {}
 
   void Fill(Event& ev) {
-    h->Fill(*number);
+    bins.Fill(*number);
+  }
+
+  void FillBlock(EventBlock& b, const uint32_t* idx, size_t n) {
+    const int* col = b.Column<int>(b.ev.BranchName(number));
+    if (!col) {
+      return Hist::FillBlock(b, idx, n);
+    }
+
+    for (size_t k=0; k<n; k++) {
+      bins.Fill(col[idx[k]]);
+    }
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    b.insert(ev.BranchName(number));
   }
 
   int* number;
 };
 
 
-class Hist_intmode : public Hist {
+class Hist_intmode : public Hist1<AxisMode, TH1I> {
 public:
-  Hist_intmode(TString name) : Hist(
-    new TH1I(name,
-             ";Interaction mode;Entries",
-             11, 0, 11)) {
-    const char* modes[11] = {
-      "CCQE", "CCMEC", "CCRes", "CCDIS", "CCCoh",
-      "NCEL", "NCMEC", "NCRes", "NCDIS", "NCCoh",
-      "Other"
-    };
-
-    for (int i=1; i<=11; i++) {
-      h->GetXaxis()->SetBinLabel(i, modes[i-1]);
+  Hist_intmode(TString name) : Hist1(
+    name,
+    ";Interaction mode;Entries") {
+    for (int i=1; i<=Event::kNModes; i++) {
+      h->GetXaxis()->SetBinLabel(i, Event::ModeName(i-1));
     }
   }
 
+  int Cell(Event& ev) {
+    return bins.Cell(ev.intmode());
+  }
+
   void Fill(Event& ev) {
-    h->Fill(ev.intmode());
+    bins.Fill(ev.intmode());
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, Event::intmodeBranches());
   }
 };
 
 
-class Hist_ke : public Hist {
+class Hist_ke : public Hist1<AxisKE> {
 public:
-  Hist_ke(TString name, TString particle) : Hist(
-    new TH1D(name,
-             TString(";")  + particle + " Kinetic energy T_{" + particle + "} (GeV)",
-             200, 0, 3.500)) {}
+  Hist_ke(TString name, TString particle) : Hist1(
+    name,
+    TString(";")  + particle + " Kinetic energy T_{" + particle + "} (GeV)") {}
 
   void Fill(Event& ev) {
-    h->Fill(ev.tmu());
+    bins.Fill(ev.tmu());
+  }
+
+  bool Coords(Event& ev, double* v) {
+    v[0] = ev.tmu();
+    return true;
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, Event::tmuBranches());
   }
 };
 
 
-class Hist_cosTheta : public Hist {
+class Hist_cosTheta : public Hist1<AxisCosTheta> {
 public:
-  Hist_cosTheta(TString name, TString particle) : Hist(
-    new TH1D(name,
-             TString(";cos#theta_{") + particle + "}",
-             100, -1, 1)) {}
+  Hist_cosTheta(TString name, TString particle) : Hist1(
+    name,
+    TString(";cos#theta_{") + particle + "}") {}
 
   void Fill(Event& ev) {
-    h->Fill(ev.ctmu());
+    bins.Fill(ev.ctmu());
+  }
+
+  bool Coords(Event& ev, double* v) {
+    v[0] = ev.ctmu();
+    return true;
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, Event::ctmuBranches());
   }
 };
 
 
-class Hist_Tct : public Hist {
+class Hist_Tct : public Hist2<AxisKE2D, AxisCosTheta> {
 public:
-  Hist_Tct(TString name, TString particle) : Hist(
-    new TH2D(name,
-             TString(";") + particle + " Kinetic energy p_{" + particle + "} (GeV);cos#theta_{" + particle + "}",
-             100, 0, 3.5, 100, -1, 1)) {}
+  Hist_Tct(TString name, TString particle) : Hist2(
+    name,
+    TString(";") + particle + " Kinetic energy p_{" + particle + "} (GeV);cos#theta_{" + particle + "}") {}
+
+  int Cell(Event& ev) {
+    return bins.Cell(ev.tmu(), ev.ctmu());
+  }
+
+  bool Coords(Event& ev, double* v) {
+    v[0] = ev.tmu();
+    v[1] = ev.ctmu();
+    return true;
+  }
 
   void Fill(Event& ev) {
-    h->Fill(ev.tmu(), ev.ctmu());
+    bins.Fill(ev.tmu(), ev.ctmu());
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, Event::tmuBranches());
+    Event::Need(b, Event::ctmuBranches());
   }
 };
 
 
-class Hist_leadpKE : public Hist {
+class Hist_leadpKE : public Hist1<AxisLeadpKE> {
 public:
-  Hist_leadpKE(TString name, TString particle) : Hist(
-    new TH1D(name,
-             TString(";")  + particle + " Kinetic energy T_{" + particle + "} (GeV)",
-             200, 0, 1.0)) {}
+  Hist_leadpKE(TString name, TString particle) : Hist1(
+    name,
+    TString(";")  + particle + " Kinetic energy T_{" + particle + "} (GeV)") {}
 
   void Fill(Event& ev) {
-    std::vector<double> pke;
-    for (int ii=0; ii<ev.ni; ii++) {
-      if (ev.pdgi[ii] == 2212) {
-        pke.push_back(ev.ei[ii] - 0.938272);
-      }
+    const Event::Features& f = ev.PreFSI();
+
+    if (f.nip > 0) {
+      bins.Fill(f.leadpke);
     }
+  }
 
-    std::sort(pke.begin(), pke.end());
+  bool Coords(Event& ev, double* v) {
+    const Event::Features& f = ev.PreFSI();
+    v[0] = f.leadpke;
+    return f.nip > 0;
+  }
 
-    if (!pke.empty()) {
-      h->Fill(pke[pke.size() - 1]);
-    }
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, "ni pdgi Ei");
   }
 };
 
 
-class Hist_pKE : public Hist {
+class Hist_pKE : public Hist2<AxispKE, AxispKE> {
 public:
-  Hist_pKE(TString name) : Hist(
-    new TH2D(name,
-             ";Leading p kinetic energy T_{p1} (GeV);Subleading p kinetic energy T_{p2} (GeV)",
-             100, 0, 1.000, 100, 0, 1.000)) {}
+  Hist_pKE(TString name) : Hist2(
+    name,
+    ";Leading p kinetic energy T_{p1} (GeV);Subleading p kinetic energy T_{p2} (GeV)") {}
 
   void Fill(Event& ev) {
-    // Proton kinetic energies: build a stack
-    std::vector<double> pke;
-    for (int ii=0; ii<ev.ni; ii++) {
-      if (ev.pdgi[ii] == 2212) {
-        pke.push_back(ev.ei[ii] - 0.938272);
-      }
+    const Event::Features& f = ev.PreFSI();
+
+    if (f.nip > 2) {
+      std::cout << "MEC party: " << f.nip << " intermediate protons" << std::endl;
     }
 
-    if (pke.size() > 2) {
-      std::cout << "MEC party: " << pke.size() << " intermediate protons" << std::endl;
+    if (f.nip > 1) {
+      double p1 = TMath::Max(f.pke[0], f.pke[1]);
+      double p2 = TMath::Min(f.pke[0], f.pke[1]);
+      bins.Fill(p1, p2);
     }
+  }
 
-    if (pke.size() > 1) {
-      double p1 = TMath::Max(pke[0], pke[1]);
-      double p2 = TMath::Min(pke[0], pke[1]);
-      h->Fill(p1, p2);
+  bool Coords(Event& ev, double* v) {
+    const Event::Features& f = ev.PreFSI();
+    if (f.nip < 2) {
+      return false;
     }
+    v[0] = TMath::Max(f.pke[0], f.pke[1]);
+    v[1] = TMath::Min(f.pke[0], f.pke[1]);
+    return true;
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, "ni pdgi Ei");
   }
+};
+
+
+/** A per-event quantity, by name, for Hist_var. */
+struct Variable {
+  const char* name;
+  double (*get)(Event& ev);
+  std::string branches;  //!< Branches read by get
+
+  /** Look up a variable by name; returns NULL if there is none. */
+  static const Variable* Find(std::string name) {
+    static const Variable vars[] = {
+      { "q0", [](Event& e) -> double { return e.q0(); }, Event::q0Branches() },
+      { "q3", [](Event& e) -> double { return e.q3(); }, Event::q3Branches() },
+      { "tmu", [](Event& e) -> double { return e.tmu(); }, Event::tmuBranches() },
+      { "ctmu", [](Event& e) -> double { return e.ctmu(); }, Event::ctmuBranches() },
+      { "Ev", [](Event& e) -> double { return e.enu; }, "Ev" },
+      { "El", [](Event& e) -> double { return e.elep; }, "El" },
+      { "W", [](Event& e) -> double { return e.w; }, "W" },
+      { "Q2", [](Event& e) -> double { return e.q2; }, "Q2" },
+      { "x", [](Event& e) -> double { return e.x; }, "x" },
+      { "y", [](Event& e) -> double { return e.y; }, "y" },
+      { "leadpke", [](Event& e) -> double { return e.PreFSI().leadpke; }, "ni pdgi Ei" }
+    };
 
-  void Write(TString config, TString gen, TFile* f) { 
-    h->GetXaxis()->SetRangeUser(0, 0.8);
-    h->GetYaxis()->SetRangeUser(0, 0.8);
-    TPaveText* l = genie_label(config, gen);
-    l->Draw();
-    Hist::Write(config, gen, f, false, true);
+    for (size_t i=0; i<sizeof(vars) / sizeof(vars[0]); i++) {
+      if (name == vars[i].name) {
+        return &vars[i];
+      }
+    }
+    return NULL;
   }
 };
 
+
+/** A histogram of any Variable, with the binning given at run time. */
+class Hist_var : public Hist {
+public:
+  Hist_var(TString name, TString title, const Variable* _var,
+           int nbins, double min, double max)
+    : Hist(new TH1D(name, title, nbins, min, max)), var(_var) {}
+
+  void Fill(Event& ev) {
+    h->Fill(var->get(ev));
+  }
+
+  void Branches(Event& ev, std::set<std::string>& b) {
+    Event::Need(b, var->branches);
+  }
+
+  const Variable* var;
+};
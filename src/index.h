@@ -0,0 +1,221 @@
+/**
+ * Sidecar event index: a few bytes per entry with the interaction mode,
+ * nuance code, neutrino flavor and topology flags of each event, so a
+ * pass with narrow selections (e.g. CCMEC only) reads only the entries
+ * that can pass.
+ *
+ * The file starts with a text header, listing the input files (as in the
+ * Ledger, so a stale index can be detected), followed by one binary
+ * IndexRecord per entry, in the native byte order:
+ *
+ *     gstindex 1
+ *     entries <nevents>
+ *     files <nfiles>
+ *     <path> <size> <mtime>
+ *     ...
+ *     records
+ *     <IndexRecord x nevents>
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <TString.h>
+
+/** Index entry for one event */
+struct IndexRecord {
+  int32_t neu;  //!< Neutrino PDG code
+  int16_t nuance_code;
+  uint8_t mode;  //!< Event::intmode
+  uint8_t flags;  //!< Bits from EventIndex::Flag
+};
+
+
+/**
+ * \class EventIndex
+ * \brief Per-entry selection data for a sample, read from a sidecar file.
+ */
+class EventIndex {
+public:
+  enum Flag { kCC = 1 << 0, kNC = 1 << 1, k1l1p0pi0 = 1 << 2,
+              k1l1trk0pi0 = 1 << 3 };
+
+  /** Branches read to build an index. */
+  static void Branches(std::set<std::string>& b) {
+    Event::Need(b, "neu nuance_code");
+    Event::Branches(Event::isCCQE, b);
+    Event::Branches(Event::is1l1p0pi0, b);
+  }
+
+  /** The index record for the current entry of ev. */
+  static IndexRecord Record(Event& ev) {
+    IndexRecord r;
+    r.neu = ev.neu;
+    r.nuance_code = ev.nuance_code;
+    r.mode = ev.intmode();
+    r.flags = ((ev.cc ? kCC : 0) | (ev.nc ? kNC : 0) |
+               (Event::is1l1p0pi0(ev) ? k1l1p0pi0 : 0) |
+               (Event::is1l1trk0pi0(ev) ? k1l1trk0pi0 : 0));
+    return r;
+  }
+
+  /**
+   * Whether a selection can be decided from the index alone; if so,
+   * Pass gives the result.
+   */
+  static bool Indexable(Event::EventType sel) {
+    if (sel == Event::isCC || sel == Event::isNC ||
+        sel == Event::is1l1p0pi0 || sel == Event::is1l1trk0pi0) {
+      return true;
+    }
+    for (int i=0; i<Event::kNModes; i++) {
+      if (sel == Event::ModeSelection(i)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool Pass(Event::EventType sel, const IndexRecord& r) {
+    if (sel == Event::isCC) return r.flags & kCC;
+    if (sel == Event::isNC) return r.flags & kNC;
+    if (sel == Event::is1l1p0pi0) return r.flags & k1l1p0pi0;
+    if (sel == Event::is1l1trk0pi0) return r.flags & k1l1trk0pi0;
+    for (int i=0; i<Event::kNModes; i++) {
+      if (sel == Event::ModeSelection(i)) {
+        return r.mode == i;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Build the index for all entries of ev, whose tree reads files, and
+   * write it to path. Returns the number of entries, or -1 on error.
+   */
+  static long Write(Event& ev, const std::vector<TString>& files,
+                    std::string path) {
+    std::ofstream f(path.c_str(), std::ios::binary);
+    if (!f) {
+      std::cerr << "Index: cannot create " << path << std::endl;
+      return -1;
+    }
+
+    std::set<std::string> branches;
+    Branches(branches);
+    ev.SetActive(branches);
+
+    long n = ev.GetEntries();
+    f << "gstindex 1" << std::endl;
+    f << "entries " << n << std::endl;
+    f << "files " << files.size() << std::endl;
+    for (size_t i=0; i<files.size(); i++) {
+      FileStamp s = Stamp(files[i].Data());
+      f << files[i] << " " << s.size << " " << s.mtime << std::endl;
+    }
+    f << "records" << std::endl;
+
+    for (long i=0; i<n; i++) {
+      ev.GetEntry(i);
+      IndexRecord r = Record(ev);
+      f.write((const char*) &r, sizeof(r));
+    }
+
+    f.close();
+    return (f.good() ? n : -1);
+  }
+
+  /** Read an index file. Returns false if it can't be read. */
+  bool Read(std::string path) {
+    std::ifstream f(path.c_str(), std::ios::binary);
+    std::string line, key;
+    long n = -1, nfiles = -1;
+    int version = 0;
+
+    if (!std::getline(f, line) || sscanf(line.c_str(), "gstindex %d", &version) != 1 ||
+        version != 1) {
+      std::cerr << "Index: " << path << " is not an index" << std::endl;
+      return false;
+    }
+
+    while (std::getline(f, line) && line != "records") {
+      std::istringstream ss(line);
+      ss >> key;
+      if (key == "entries") {
+        ss >> n;
+      }
+      else if (key == "files") {
+        ss >> nfiles;
+      }
+      else {
+        FileStamp s;
+        ss >> s.size >> s.mtime;
+        files.push_back(std::make_pair(key, s));
+      }
+    }
+
+    if (n < 0 || nfiles != (long) files.size()) {
+      std::cerr << "Index: bad header in " << path << std::endl;
+      return false;
+    }
+
+    records.resize(n);
+    if (n > 0) {
+      f.read((char*) &records[0], n * sizeof(IndexRecord));
+    }
+    if (!f) {
+      std::cerr << "Index: " << path << " is truncated" << std::endl;
+      records.clear();
+      return false;
+    }
+
+    return true;
+  }
+
+  /** Whether the index was built from these files, unchanged. */
+  bool Matches(const std::vector<TString>& inputs) const {
+    if (inputs.size() != files.size()) {
+      return false;
+    }
+    for (size_t i=0; i<inputs.size(); i++) {
+      if (files[i].first != inputs[i].Data() ||
+          !(files[i].second == Stamp(inputs[i].Data()))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * The entries passing any of a set of selections.
+   *
+   * Returns false if some selection can't be decided from the index.
+   */
+  bool Select(const std::vector<Event::EventType>& sels,
+              std::vector<long>& entries) const {
+    for (size_t i=0; i<sels.size(); i++) {
+      if (!Indexable(sels[i])) {
+        return false;
+      }
+    }
+
+    entries.clear();
+    for (size_t j=0; j<records.size(); j++) {
+      for (size_t i=0; i<sels.size(); i++) {
+        if (Pass(sels[i], records[j])) {
+          entries.push_back(j);
+          break;
+        }
+      }
+    }
+    return true;
+  }
+
+  std::vector<std::pair<std::string, FileStamp> > files;  //!< Inputs indexed
+  std::vector<IndexRecord> records;  //!< One per entry
+};
@@ -0,0 +1,302 @@
+/**
+ * Batch kernels: the Event getters computed over the columns of an
+ * EventBlock.
+ *
+ * Each kernel is a plain loop over arrays, with no temporaries or calls
+ * through function pointers, which the compiler can vectorize. The kernels
+ * use the same helpers as the scalar getters (Event::Mode, Event::Mag,
+ * ...), so each value comes from the same operations in the same order
+ * and the results are bit-identical, as long as the compiler doesn't
+ * contract or reorder floating point operations (the default in ISO C++
+ * mode). ggst --check-kernels compares them, event by event, with the
+ * getters and the ROOT vector classes.
+ */
+
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <TVector3.h>
+
+/** q0 = Ev - El */
+void BatchQ0(const double* enu, const double* elep, double* q0, size_t n) {
+  for (size_t i=0; i<n; i++) {
+    q0[i] = enu[i] - elep[i];
+  }
+}
+
+
+/** q3 = |p_nu - p_lep| */
+void BatchQ3(const double* pxv, const double* pyv, const double* pzv,
+             const double* pxl, const double* pyl, const double* pzl,
+             double* q3, size_t n) {
+  for (size_t i=0; i<n; i++) {
+    q3[i] = Event::Mag(pxv[i] - pxl[i], pyv[i] - pyl[i], pzv[i] - pzl[i]);
+  }
+}
+
+
+/** Lepton mass and kinetic energy */
+void BatchTmu(const bool* cc, const bool* nc, const int* neu,
+              const double* elep, double* lmass, float* tmu, size_t n) {
+  for (size_t i=0; i<n; i++) {
+    lmass[i] = Event::LeptonMass(cc[i], nc[i], neu[i]);
+    tmu[i] = elep[i] - lmass[i];
+  }
+}
+
+
+/** Lepton cos theta */
+void BatchCtmu(const double* pxl, const double* pyl, const double* pzl,
+               float* ctmu, size_t n) {
+  for (size_t i=0; i<n; i++) {
+    ctmu[i] = Event::CosTheta(pxl[i], pyl[i], pzl[i]);
+  }
+}
+
+
+/** Interaction mode */
+void BatchMode(const bool* cc, const bool* nc, const bool* qel,
+               const bool* res, const bool* dis, const bool* coh,
+               const int* nuance_code, int* mode, size_t n) {
+  for (size_t i=0; i<n; i++) {
+    mode[i] = Event::Mode(cc[i], nc[i], qel[i], res[i], dis[i], coh[i],
+                          nuance_code[i]);
+  }
+}
+
+
+/**
+ * Post-FSI particle counts (see Event::PostFSI), from particle columns
+ * with per-event offsets (see EventBlock::Particles).
+ */
+void BatchPostFSI(const uint32_t* off, const int* pdg, const double* e,
+                  unsigned* nfp60, unsigned* nfpi0, unsigned* nfpiq,
+                  size_t n) {
+  for (size_t i=0; i<n; i++) {
+    unsigned p60 = 0, pi0 = 0, piq = 0;
+    for (uint32_t k=off[i]; k<off[i+1]; k++) {
+      p60 += (pdg[k] == 2212 && e[k] - 0.938272 > 0.060);
+      pi0 += (pdg[k] == 111);
+      piq += (pdg[k] == 211);
+    }
+    nfp60[i] = p60;
+    nfpi0[i] = pi0;
+    nfpiq[i] = piq;
+  }
+}
+
+
+/**
+ * \class BlockFeatures
+ * \brief Event Features for a block, computed with the batch kernels.
+ *
+ * Compute fills each group of Features whose branches are buffered in the
+ * block, Store saves them with the block's rows (so the scalar getters
+ * find them), and Select evaluates selections as masks over the block.
+ */
+class BlockFeatures {
+public:
+  BlockFeatures(size_t capacity=0)
+      : valid(0), cc(NULL), nc(NULL), neu(NULL) {
+    Reserve(capacity);
+  }
+
+  void Reserve(size_t capacity) {
+    mode.resize(capacity);
+    q0.resize(capacity);
+    q3.resize(capacity);
+    lmass.resize(capacity);
+    tmu.resize(capacity);
+    ctmu.resize(capacity);
+    nfp60.resize(capacity);
+    nfpi0.resize(capacity);
+    nfpiq.resize(capacity);
+  }
+
+  /** Compute the Features for a block; returns the valid bits. */
+  unsigned Compute(const EventBlock& b) {
+    size_t n = b.n;
+    valid = 0;
+    if (mode.size() < n) {
+      Reserve(b.capacity);
+    }
+
+    cc = b.Column<bool>("cc");
+    nc = b.Column<bool>("nc");
+    neu = b.Column<int>("neu");
+    const bool* qel = b.Column<bool>("qel");
+    const bool* res = b.Column<bool>("res");
+    const bool* dis = b.Column<bool>("dis");
+    const bool* coh = b.Column<bool>("coh");
+    const int* nuance = b.Column<int>("nuance_code");
+    const double* enu = b.Column<double>("Ev");
+    const double* elep = b.Column<double>("El");
+    const double* pxv = b.Column<double>("pxv");
+    const double* pyv = b.Column<double>("pyv");
+    const double* pzv = b.Column<double>("pzv");
+    const double* pxl = b.Column<double>("pxl");
+    const double* pyl = b.Column<double>("pyl");
+    const double* pzl = b.Column<double>("pzl");
+
+    if (cc && nc && qel && res && dis && coh && nuance) {
+      BatchMode(cc, nc, qel, res, dis, coh, nuance, &mode[0], n);
+      valid |= Event::kMode;
+    }
+    if (enu && elep) {
+      BatchQ0(enu, elep, &q0[0], n);
+      valid |= Event::kQ0;
+    }
+    if (pxv && pyv && pzv && pxl && pyl && pzl) {
+      BatchQ3(pxv, pyv, pzv, pxl, pyl, pzl, &q3[0], n);
+      valid |= Event::kQ3;
+    }
+    if (cc && nc && neu && elep) {
+      BatchTmu(cc, nc, neu, elep, &lmass[0], &tmu[0], n);
+      valid |= Event::kLmass | Event::kTmu;
+    }
+    if (pxl && pyl && pzl) {
+      BatchCtmu(pxl, pyl, pzl, &ctmu[0], n);
+      valid |= Event::kCtmu;
+    }
+
+    // Both are indexed by nf, so have the same offsets
+    const uint32_t* off = NULL;
+    const int* pdgf = b.Particles<int>("pdgf", off);
+    const double* ef = b.Particles<double>("Ef", off);
+    if (pdgf && ef) {
+      BatchPostFSI(off, pdgf, ef, &nfp60[0], &nfpi0[0], &nfpiq[0], n);
+      valid |= Event::kPostFSI;
+    }
+
+    return valid;
+  }
+
+  /** Save the computed Features with the block's rows. */
+  void Store(EventBlock& b) const {
+    if (!valid) {
+      return;
+    }
+    if (b.feat.empty()) {
+      b.feat.resize(b.capacity);
+    }
+
+    for (size_t j=0; j<b.n; j++) {
+      Event::Features& f = b.feat[j];
+      if (valid & Event::kMode) f.intmode = mode[j];
+      if (valid & Event::kQ0) f.q0 = q0[j];
+      if (valid & Event::kQ3) f.q3 = q3[j];
+      if (valid & Event::kLmass) f.lmass = lmass[j];
+      if (valid & Event::kTmu) f.tmu = tmu[j];
+      if (valid & Event::kCtmu) f.ctmu = ctmu[j];
+      if (valid & Event::kPostFSI) {
+        f.nfp60 = nfp60[j];
+        f.nfpi0 = nfpi0[j];
+        f.nfpiq = nfpiq[j];
+      }
+      b.valid[j] |= valid;
+    }
+  }
+
+  /**
+   * Set bit in masks for the events passing a selection.
+   *
+   * Returns false, leaving masks as they are, if the selection has no
+   * batch form or its inputs weren't computed.
+   */
+  bool Select(Event::EventType sel, uint64_t bit, uint64_t* masks,
+              size_t n) const {
+    if (sel == Event::isAny) {
+      for (size_t i=0; i<n; i++) {
+        masks[i] |= bit;
+      }
+      return true;
+    }
+
+    if ((sel == Event::isCC && cc) || (sel == Event::isNC && nc)) {
+      const bool* c = (sel == Event::isCC ? cc : nc);
+      for (size_t i=0; i<n; i++) {
+        masks[i] |= (c[i] ? bit : 0);
+      }
+      return true;
+    }
+
+    if (valid & Event::kMode) {
+      for (int m=0; m<Event::kNModes; m++) {
+        if (sel == Event::ModeSelection(m)) {
+          for (size_t i=0; i<n; i++) {
+            masks[i] |= (mode[i] == m ? bit : 0);
+          }
+          return true;
+        }
+      }
+    }
+
+    bool topology = (valid & Event::kPostFSI) && (valid & Event::kTmu) && neu;
+    if (topology && sel == Event::is1l1p0pi0) {
+      for (size_t i=0; i<n; i++) {
+        bool pass = (cc[i] && nfp60[i] == 1 && nfpi0[i] == 0 &&
+                     Event::PassTmu(neu[i], tmu[i]));
+        masks[i] |= (pass ? bit : 0);
+      }
+      return true;
+    }
+    if (topology && sel == Event::is1l1trk0pi0) {
+      for (size_t i=0; i<n; i++) {
+        bool pass = (cc[i] && nfp60[i] + nfpiq[i] == 1 &&
+                     Event::PassTmu(neu[i], tmu[i]));
+        masks[i] |= (pass ? bit : 0);
+      }
+      return true;
+    }
+
+    return false;
+  }
+
+  unsigned valid;  //!< Groups of Features computed for the current block
+
+  std::vector<int> mode;
+  std::vector<double> q0, q3, lmass;
+  std::vector<float> tmu, ctmu;
+  std::vector<unsigned> nfp60, nfpi0, nfpiq;
+
+protected:
+  const bool* cc;  //!< Columns used by the selections
+  const bool* nc;
+  const int* neu;
+};
+
+
+/**
+ * Compare Features from the kernels with the scalar getters for the
+ * current entry of ev. Returns the number of groups that differ.
+ */
+int CheckFeatures(Event& ev, const Event::Features& f, unsigned bits) {
+  ev.valid = 0;
+  int bad = 0;
+
+  if (bits & Event::kMode) {
+    bad += (f.intmode != ev.intmode());
+  }
+  if (bits & Event::kQ0) {
+    double q0 = ev.enu - ev.elep;
+    bad += (memcmp(&f.q0, &q0, sizeof(q0)) != 0);
+  }
+  if (bits & Event::kQ3) {
+    double q3 = (TVector3(ev.pxv, ev.pyv, ev.pzv) - TVector3(ev.pxl, ev.pyl, ev.pzl)).Mag();
+    bad += (memcmp(&f.q3, &q3, sizeof(q3)) != 0);
+  }
+  if (bits & Event::kTmu) {
+    float tmu = ev.tmu();
+    bad += (memcmp(&f.tmu, &tmu, sizeof(tmu)) != 0);
+  }
+  if (bits & Event::kCtmu) {
+    float ctmu = ev.plep().Vect().CosTheta();
+    bad += (memcmp(&f.ctmu, &ctmu, sizeof(ctmu)) != 0);
+  }
+  if (bits & Event::kPostFSI) {
+    const Event::Features& s = ev.PostFSI();
+    bad += (f.nfp60 != s.nfp60 || f.nfpi0 != s.nfpi0 || f.nfpiq != s.nfpiq);
+  }
+
+  return bad;
+}
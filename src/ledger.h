@@ -0,0 +1,127 @@
+/**
+ * Bookkeeping for incremental processing: a ledger of the input files that
+ * have already been folded into a checkpoint.
+ *
+ * Files are identified by path, size and modification time. The ledger is
+ * kept as text, one "path size mtime" line per file, in the checkpoint
+ * file itself, so the histograms and the list of files they contain are
+ * always updated together.
+ */
+
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glob.h>
+#include <sys/stat.h>
+#include <TString.h>
+
+/** Size and modification time of a file. */
+struct FileStamp {
+  FileStamp() : size(-1), mtime(0) {}
+  long size;
+  long mtime;
+
+  bool operator==(const FileStamp& o) const {
+    return size == o.size && mtime == o.mtime;
+  }
+};
+
+
+/** Look up the stamp of a file; size is -1 if it can't be read. */
+FileStamp Stamp(std::string path) {
+  FileStamp s;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    s.size = st.st_size;
+    s.mtime = st.st_mtime;
+  }
+  return s;
+}
+
+
+/** Expand wildcards in a list of file patterns, as TChain::Add would. */
+std::vector<TString> ExpandFiles(const std::vector<TString>& patterns) {
+  std::vector<TString> files;
+  for (size_t i=0; i<patterns.size(); i++) {
+    glob_t g;
+    if (glob(patterns[i].Data(), 0, NULL, &g) == 0) {
+      for (size_t j=0; j<g.gl_pathc; j++) {
+        files.push_back(g.gl_pathv[j]);
+      }
+    }
+    globfree(&g);
+  }
+  return files;
+}
+
+
+/**
+ * \class Ledger
+ * \brief The set of input files already processed.
+ */
+class Ledger {
+public:
+  Ledger(std::string text="") {
+    std::istringstream ss(text);
+    std::string file;
+    FileStamp s;
+    while (ss >> file >> s.size >> s.mtime) {
+      files[file] = s;
+    }
+  }
+
+  /**
+   * Select the files not yet in the ledger.
+   *
+   * Files modified in the last minAge seconds may still be arriving, and
+   * are left for a later pass. Files already processed that have changed
+   * since can't be taken back out of the checkpoint, so they are reported
+   * and skipped.
+   */
+  std::vector<TString> Select(const std::vector<TString>& candidates,
+                              long minAge=60) {
+    std::vector<TString> selected;
+    long now = time(NULL);
+
+    for (size_t i=0; i<candidates.size(); i++) {
+      std::string file = candidates[i].Data();
+      FileStamp s = Stamp(file);
+
+      if (files.count(file)) {
+        if (!(files[file] == s)) {
+          std::cerr << "Ledger: " << file << " changed since it was processed, skipping" << std::endl;
+        }
+      }
+      else if (s.size >= 0 && now - s.mtime >= minAge) {
+        selected.push_back(file);
+        pending[file] = s;
+      }
+    }
+
+    return selected;
+  }
+
+  /** Move the selected files into the ledger. */
+  void Commit() {
+    files.insert(pending.begin(), pending.end());
+    pending.clear();
+  }
+
+  /** The ledger as text, for storing in the checkpoint. */
+  std::string Text() const {
+    std::ostringstream ss;
+    for (auto const& it : files) {
+      ss << it.first << " " << it.second.size << " " << it.second.mtime << std::endl;
+    }
+    return ss.str();
+  }
+
+  size_t size() const { return files.size(); }
+
+protected:
+  std::map<std::string, FileStamp> files;  //!< Files in the checkpoint
+  std::map<std::string, FileStamp> pending;  //!< Files selected this pass
+};
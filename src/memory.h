@@ -0,0 +1,84 @@
+/**
+ * An in-memory event store: a range of entries, read from the tree once
+ * into structure-of-arrays blocks (see block.h), then served from memory.
+ *
+ * Useful when the per-event work is heavy compared to reading, e.g. with
+ * many weight universes, so the I/O is not interleaved with it. With
+ * compact blocks, particles take about 18 bytes each per list, so a sample
+ * of a few million events with the branches the default plan needs fits
+ * in well under a GB.
+ */
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * \class MemoryEvent
+ * \brief An Event whose entries are read into memory up front.
+ *
+ * Call SetActive, then Fetch for the entry range to hold; GetEntry then
+ * copies entries from memory into the usual Event members.
+ */
+class MemoryEvent : public Event {
+public:
+  MemoryEvent(TTree* _t, bool _compact=false)
+      : Event(_t), compact(_compact), begin(0), end(0) {
+    active.insert("*");
+  }
+
+  ~MemoryEvent() {
+    for (size_t i=0; i<blocks.size(); i++) {
+      delete blocks[i];
+    }
+  }
+
+  void SetActive(const std::set<std::string>& names) {
+    Event::SetActive(names);
+    active = names;
+  }
+
+  /** Read entries [first, last) into memory. Returns the number read. */
+  long Fetch(long first, long last, size_t blockSize=EventBlock::kDefaultSize) {
+    begin = end = first;
+    while (end < last) {
+      EventBlock* b = new EventBlock(*this, blockSize, compact);
+      b->SetActive(active);
+      if (b->Read(end, last - end) == 0) {
+        delete b;
+        break;
+      }
+      blocks.push_back(b);
+      starts.push_back(end);
+      end += b->n;
+    }
+    return end - begin;
+  }
+
+  /** Bytes held in memory. */
+  size_t Size() const {
+    size_t size = 0;
+    for (size_t i=0; i<blocks.size(); i++) {
+      for (size_t j=0; j<blocks[i]->columns.size(); j++) {
+        size += blocks[i]->columns[j].capacity();
+        size += blocks[i]->offsets[j].capacity() * sizeof(uint32_t);
+      }
+      size += blocks[i]->feat.capacity() * sizeof(Features);
+    }
+    return size;
+  }
+
+  void GetEntry(long i) {
+    size_t k = std::upper_bound(starts.begin(), starts.end(), i) - starts.begin() - 1;
+    blocks[k]->Load(i - starts[k]);
+  }
+
+  bool compact;  //!< Use compact blocks (see block.h)
+
+protected:
+  long begin, end;  //!< Entry range held
+  std::set<std::string> active;  //!< Branches to hold
+  std::vector<EventBlock*> blocks;
+  std::vector<long> starts;  //!< First entry of each block
+};
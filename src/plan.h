@@ -0,0 +1,161 @@
+/**
+ * Event loop dispatch: the booking of histograms per selection, and the flat
+ * plan it is compiled into before the loop.
+ */
+
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Histograms booked per selection: {"selection": [function, {"name": hist}]} */
+typedef std::map<std::string, std::pair<Event::EventType, std::map<std::string, Hist*> > > Booking;
+
+
+/**
+ * \class Plan
+ * \brief A Booking flattened for the event loop.
+ *
+ * For each event, all selections are evaluated into one bitmask, then the
+ * histograms of each passing selection are filled from a dense array. The
+ * string keys of the Booking are only used at write time.
+ */
+class Plan {
+public:
+  static const size_t kMaxSelections = 64;  //!< Bits in a selection mask
+
+  Plan(const Booking& hists) {
+    assert(hists.size() <= kMaxSelections);
+
+    for (auto const& h : hists) {
+      selections.push_back(h.second.first);
+      first.push_back(fills.size());
+      for (auto const& hist : h.second.second) {
+        fills.push_back(hist.second);
+      }
+    }
+    first.push_back(fills.size());
+    passed.resize(selections.size(), 0);
+  }
+
+  /** Evaluate all selections: bit i is set if selection i passes. */
+  uint64_t Select(Event& ev) const {
+    uint64_t mask = 0;
+    for (size_t i=0; i<selections.size(); i++) {
+      if (selections[i](ev)) {
+        mask |= (uint64_t) 1 << i;
+      }
+    }
+    return mask;
+  }
+
+  /** Fill the histograms of the selections set in mask. */
+  void Fill(Event& ev, uint64_t mask) {
+    while (mask) {
+      size_t i = __builtin_ctzll(mask);
+      mask &= mask - 1;
+      passed[i]++;
+      for (size_t j=first[i]; j<first[i+1]; j++) {
+        fills[j]->Fill(ev);
+      }
+    }
+  }
+
+  /**
+   * Block variant of Select: evaluate the selections for every event.
+   *
+   * The Features are computed for the whole block with the batch kernels
+   * (see kernels.h), and selections with a batch form are evaluated as
+   * masks; the rest are evaluated event by event.
+   */
+  void SelectBlock(EventBlock& b) {
+    features.Compute(b);
+    features.Store(b);
+
+    scalar.clear();
+    for (size_t j=0; j<b.n; j++) {
+      masks[j] = 0;
+    }
+    for (size_t i=0; i<selections.size(); i++) {
+      if (!features.Select(selections[i], (uint64_t) 1 << i, &masks[0], b.n)) {
+        scalar.push_back(i);
+      }
+    }
+    if (scalar.empty()) {
+      return;
+    }
+
+    for (size_t j=0; j<b.n; j++) {
+      b.Load(j);
+      for (size_t k=0; k<scalar.size(); k++) {
+        if (selections[scalar[k]](b.ev)) {
+          masks[j] |= (uint64_t) 1 << scalar[k];
+        }
+      }
+      b.Keep(j);
+    }
+  }
+
+  /**
+   * After SelectBlock, compare the batch Features and selection masks
+   * with the scalar getters and selections, event by event. Returns the
+   * number of events that differ, or all of them if the batch Features
+   * weren't stored.
+   */
+  long CheckBlock(EventBlock& b) {
+    if (b.feat.size() < b.n || masks.size() < b.n) {
+      std::cerr << "Kernel check: no batch Features for this block" << std::endl;
+      return b.n;
+    }
+
+    long bad = 0;
+    for (size_t j=0; j<b.n; j++) {
+      b.Load(j);
+      int diff = CheckFeatures(b.ev, b.feat[j], features.valid);
+      b.ev.valid = 0;
+      bad += (diff > 0 || Select(b.ev) != masks[j]);
+    }
+    return bad;
+  }
+
+  /**
+   * Block variant of Fill: after SelectBlock, fill each selection's
+   * histograms with its passing events in one call.
+   */
+  void FillBlock(EventBlock& b) {
+    for (size_t i=0; i<selections.size(); i++) {
+      idx.clear();
+      for (size_t j=0; j<b.n; j++) {
+        if (masks[j] & ((uint64_t) 1 << i)) {
+          idx.push_back(j);
+        }
+      }
+      passed[i] += idx.size();
+
+      for (size_t j=first[i]; j<first[i+1] && !idx.empty(); j++) {
+        fills[j]->FillBlock(b, &idx[0], idx.size());
+      }
+    }
+  }
+
+  /** Reserve space for block processing with blocks of up to n events. */
+  void Reserve(size_t n) {
+    masks.resize(n);
+    idx.reserve(n);
+    features.Reserve(n);
+  }
+
+  std::vector<Event::EventType> selections;  //!< Selection functions
+  std::vector<size_t> first;  //!< Index of each selection's first fill
+  std::vector<Hist*> fills;  //!< Histograms, grouped by selection
+  std::vector<long> passed;  //!< Events passing each selection
+
+protected:
+  std::vector<uint64_t> masks;  //!< Selection masks for a block
+  std::vector<uint32_t> idx;  //!< Passing events in a block
+  std::vector<size_t> scalar;  //!< Selections evaluated event by event
+  BlockFeatures features;  //!< Batch Features of a block
+};
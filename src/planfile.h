@@ -0,0 +1,215 @@
+/**
+ * Analysis plan files: the selections and histograms to fill, as text.
+ *
+ *     # Lines starting with # are comments
+ *     selection <name> <cut>
+ *     hist <selection> <key> <kind> [arguments]
+ *
+ * A cut is one of any, cc, nc, an interaction mode (CCQE, CCMEC, CCRes,
+ * ... as in Event::ModeName), 1l1p0pi0 or 1l1trk0pi0. Histogram kinds are
+ * the classes in hist.h, with their arguments:
+ *
+ *     q0q3, nuanceCode, intmode, pKE
+ *     number <branch> <title>
+ *     ke, cosTheta, Tct, leadpKE <particle>
+ *     var <variable> <nbins> <min> <max> [title]
+ *
+ * where titles and particle names run to the end of the line, and var
+ * histograms a Variable (see hist.h) with the binning given. Histograms are
+ * named h_<selection>_<key>.
+ *
+ * With universes (see universe.h), the q0q3, Tct and intmode histograms
+ * are booked with a universe copy each. With a fine factor (see sparse.h),
+ * the q0q3, ke, cosTheta, Tct, leadpKE and pKE histograms are booked with
+ * a fine sparse copy each.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/** Delete the histograms in a Booking, and clear it. */
+void ClearBooking(Booking& hists) {
+  for (auto const& h : hists) {
+    for (auto const& hist : h.second.second) {
+      delete hist.second;
+    }
+  }
+  hists.clear();
+}
+
+
+/** The selection for a cut name, or NULL if there is none. */
+Event::EventType ParseCut(std::string cut) {
+  if (cut == "any") return Event::isAny;
+  if (cut == "cc") return Event::isCC;
+  if (cut == "nc") return Event::isNC;
+  if (cut == "1l1p0pi0") return Event::is1l1p0pi0;
+  if (cut == "1l1trk0pi0") return Event::is1l1trk0pi0;
+
+  for (int i=0; i<Event::kNModes; i++) {
+    if (cut == Event::ModeName(i)) {
+      return Event::ModeSelection(i);
+    }
+  }
+
+  return NULL;
+}
+
+
+/** Book a histogram H, with a fine copy if fine > 0 (see sparse.h). */
+template<class H, class... Args>
+Hist* Fine(int fine, Args... args) {
+  if (fine > 0) {
+    return new Hist_fine<H>(fine, args...);
+  }
+  return new H(args...);
+}
+
+
+/** The rest of a line, without leading spaces. */
+std::string Rest(std::istringstream& ss) {
+  std::string rest;
+  std::getline(ss, rest);
+  size_t start = rest.find_first_not_of(" \t");
+  return (start == std::string::npos ? "" : rest.substr(start));
+}
+
+
+/**
+ * Make one histogram from the arguments of a hist line.
+ *
+ * Returns NULL (and sets err) if the kind or its arguments are bad.
+ */
+Hist* MakeHist(Event& ev, TString name, std::string kind,
+               std::istringstream& ss, Universes* u, int fine,
+               std::string& err) {
+  if (kind == "q0q3" && u) return Fine<Hist_universes<Hist_q0q3> >(fine, u, name);
+  if (kind == "intmode" && u) return new Hist_universes<Hist_intmode>(u, name);
+  if (kind == "q0q3") return Fine<Hist_q0q3>(fine, name);
+  if (kind == "nuanceCode") return new Hist_nuanceCode(name);
+  if (kind == "intmode") return new Hist_intmode(name);
+  if (kind == "pKE") return Fine<Hist_pKE>(fine, name);
+
+  if (kind == "number") {
+    std::string branch;
+    ss >> branch;
+    for (size_t i=0; i<ev.bindings.size(); i++) {
+      const Event::Binding& b = ev.bindings[i];
+      if (b.name == branch && !b.count && b.size == sizeof(int)) {
+        return new Hist_number(name, Rest(ss).c_str(), (int*) b.addr);
+      }
+    }
+    err = "no integer branch " + branch;
+    return NULL;
+  }
+
+  if (kind == "ke" || kind == "cosTheta" || kind == "Tct" || kind == "leadpKE") {
+    TString particle = Rest(ss).c_str();
+    if (particle == "") {
+      err = "no particle for " + kind;
+      return NULL;
+    }
+    if (kind == "ke") return Fine<Hist_ke>(fine, name, particle);
+    if (kind == "cosTheta") return Fine<Hist_cosTheta>(fine, name, particle);
+    if (kind == "Tct" && u) return Fine<Hist_universes<Hist_Tct> >(fine, u, name, particle);
+    if (kind == "Tct") return Fine<Hist_Tct>(fine, name, particle);
+    return Fine<Hist_leadpKE>(fine, name, particle);
+  }
+
+  if (kind == "var") {
+    std::string variable;
+    int nbins = 0;
+    double min = 0, max = 0;
+    ss >> variable >> nbins >> min >> max;
+    const Variable* var = Variable::Find(variable);
+    if (!var) {
+      err = "no variable " + variable;
+      return NULL;
+    }
+    if (!ss || nbins < 1 || !(min < max)) {
+      err = "bad binning for " + variable;
+      return NULL;
+    }
+    std::string title = Rest(ss);
+    if (title == "") {
+      title = ";" + variable + ";Entries";
+    }
+    return new Hist_var(name, title.c_str(), var, nbins, min, max);
+  }
+
+  err = "unknown histogram kind " + kind;
+  return NULL;
+}
+
+
+/**
+ * Book the histograms in a plan for an Event.
+ *
+ * As for any Booking, histograms like Hist_number point into the Event's
+ * branch buffers, so each Event needs its own (and its own Universes, if
+ * any). With fine > 0, histograms that can have one get a fine copy with
+ * that many cells per bin. Returns false, with a message, if the plan has
+ * an error.
+ */
+bool ReadPlan(Event& ev, const std::string& text, Booking& hists,
+              Universes* u=NULL, int fine=0) {
+  std::istringstream plan(text);
+  std::string line;
+  int nline = 0;
+
+  while (std::getline(plan, line)) {
+    nline++;
+    std::istringstream ss(line);
+    std::string cmd, sel, arg;
+    if (!(ss >> cmd) || cmd[0] == '#') {
+      continue;
+    }
+
+    std::string err;
+    if (cmd == "selection") {
+      ss >> sel >> arg;
+      Event::EventType type = ParseCut(arg);
+      if (sel == "" || !type) {
+        err = "bad selection";
+      }
+      else if (hists.count(sel)) {
+        err = "duplicate selection " + sel;
+      }
+      else if (hists.size() == Plan::kMaxSelections) {
+        err = "too many selections";
+      }
+      else {
+        hists[sel].first = type;
+      }
+    }
+    else if (cmd == "hist") {
+      std::string key, kind;
+      ss >> sel >> key >> kind;
+      if (!hists.count(sel)) {
+        err = "unknown selection " + sel;
+      }
+      else if (hists[sel].second.count(key)) {
+        err = "duplicate histogram " + sel + " " + key;
+      }
+      else {
+        TString name = TString("h_") + sel.c_str() + "_" + key.c_str();
+        Hist* h = MakeHist(ev, name, kind, ss, u, fine, err);
+        if (h) {
+          hists[sel].second[key] = h;
+        }
+      }
+    }
+    else {
+      err = "unknown command " + cmd;
+    }
+
+    if (err != "") {
+      std::cerr << "Plan line " << nline << ": " << err << std::endl;
+      ClearBooking(hists);
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,193 @@
+/**
+ * Pipelined reading: a background thread reads and decompresses blocks of
+ * entries ahead of the analysis, and hands them over through a bounded
+ * queue, so reading the next blocks overlaps with selecting and filling
+ * the current one.
+ *
+ * The reader's tree has a TTreeCache for the active branches, so the
+ * baskets of a cluster are fetched in a few large reads rather than one
+ * per branch, which matters most on network filesystems. With both sides
+ * busy, the wall time of a loop approaches the larger of the I/O and the
+ * compute time rather than their sum.
+ */
+
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <TTree.h>
+
+/**
+ * \class PrefetchEvent
+ * \brief An Event whose entries are read ahead on a background thread.
+ *
+ * The tree is read by a separate Event (with its own branch buffers) on
+ * the reader thread, into a fixed set of EventBlocks that cycle between
+ * the reader and the analysis: at most depth blocks are read ahead, so
+ * memory stays bounded however slow the analysis is.
+ *
+ * Call Start with the entry range, then GetEntry for each entry in order,
+ * and Stop at the end.
+ */
+class PrefetchEvent : public Event {
+public:
+  static const long kCacheSize = 32 * 1024 * 1024;  //!< TTreeCache bytes
+
+  PrefetchEvent(TTree* _t, size_t _depth=4,
+                size_t _blockSize=EventBlock::kDefaultSize)
+      : Event(NULL), depth(_depth), blockSize(_blockSize), reader(_t),
+        cur(NULL), done(false), stop(false) {
+    active.insert("*");
+  }
+
+  ~PrefetchEvent() {
+    Stop();
+  }
+
+  long GetEntries() { return reader.GetEntries(); }
+
+  void SetActive(const std::set<std::string>& names) {
+    reader.SetActive(names);
+    active = names;
+  }
+
+  /** Start reading entries [first, last) ahead. */
+  void Start(long first, long last) {
+    Stop();
+
+    // Cache the baskets of the active branches for the range read
+    TTree* t = reader.gst;
+    t->SetCacheSize(kCacheSize);
+    if (active.count("*")) {
+      t->AddBranchToCache("*", true);
+    }
+    else {
+      for (auto const& name : active) {
+        t->AddBranchToCache(name.c_str(), true);
+      }
+    }
+    t->SetCacheEntryRange(first, last);
+    t->StopCacheLearningPhase();
+
+    for (size_t i=0; i<depth; i++) {
+      EventBlock* b = new EventBlock(reader, blockSize);
+      b->SetActive(active);
+      blocks.push_back(b);
+      spare.push_back(b);
+    }
+
+    done = stop = false;
+    thread = std::thread(&PrefetchEvent::ReadAhead, this, first, last);
+  }
+
+  /** Stop reading ahead, and fold in the reader's byte counts. */
+  void Stop() {
+    if (thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      cv.notify_all();
+      thread.join();
+
+      zipRead = reader.zipRead;
+      zipTotal = reader.zipTotal;
+      branchBytes = reader.BranchBytes();
+    }
+
+    for (size_t i=0; i<blocks.size(); i++) {
+      delete blocks[i];
+    }
+    blocks.clear();
+    spare.clear();
+    full.clear();
+    cur = NULL;
+  }
+
+  /** Load entry i; entries must be read in order, within the range. */
+  void GetEntry(long i) {
+    while (!cur || i >= cur->first + (long) cur->n) {
+      cur = Next(cur);
+      if (!cur) {
+        std::cerr << "Prefetch: entry " << i << " was not read" << std::endl;
+        return;
+      }
+    }
+    assert(i >= cur->first);
+    cur->Load(i - cur->first, *this);
+  }
+
+  size_t depth;  //!< Maximum blocks read ahead
+  size_t blockSize;  //!< Entries per block
+
+protected:
+  /** Reader thread: fill spare blocks in turn, and queue them. */
+  void ReadAhead(long first, long last) {
+    long next = first;
+    while (next < last) {
+      EventBlock* b;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return stop || !spare.empty(); });
+        if (stop) {
+          break;
+        }
+        b = spare.front();
+        spare.pop_front();
+      }
+
+      size_t n = b->Read(next, last - next);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (n == 0) {
+          spare.push_back(b);
+          break;
+        }
+        full.push_back(b);
+      }
+      cv.notify_all();
+      next += n;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    cv.notify_all();
+  }
+
+  /** Hand back a used block, and wait for the next; NULL at the end. */
+  EventBlock* Next(EventBlock* used) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (used) {
+      spare.push_back(used);
+      cv.notify_all();
+    }
+    cv.wait(lock, [this] { return done || !full.empty(); });
+    if (full.empty()) {
+      return NULL;
+    }
+    EventBlock* b = full.front();
+    full.pop_front();
+    return b;
+  }
+
+  Event reader;  //!< Reads the tree, on the reader thread
+  std::set<std::string> active;  //!< Branches to read
+  std::vector<EventBlock*> blocks;  //!< All blocks, for cleanup
+  std::deque<EventBlock*> spare;  //!< Blocks ready to be read into
+  std::deque<EventBlock*> full;  //!< Blocks read, in entry order
+  EventBlock* cur;  //!< Block being analyzed
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done;  //!< The reader has finished
+  bool stop;  //!< The reader should finish early
+};
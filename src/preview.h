@@ -0,0 +1,148 @@
+/**
+ * Preview runs: fill the histograms from a random subsample of the input,
+ * read in rounds, and stop as soon as they are precise enough.
+ *
+ * The sample is split into chunks of consecutive entries (so each chunk
+ * is read efficiently), and the chunks are ordered so that every prefix
+ * of the order is spread evenly over the files: first one random chunk
+ * of each file, then a second, and so on, with the files in a new random
+ * order each time. Rounds take the next chunks in this order.
+ *
+ * After each round, the precision of each histogram is the relative
+ * statistical uncertainty of the bin of an average entry in range,
+ *
+ *     sum_i n_i (1 / sqrt(n_i)) / sum_i n_i = sum_i sqrt(n_i) / sum_i n_i,
+ *
+ * which falls as 1 / sqrt(entries) for a fixed shape, and is large while
+ * the filled bins hold few entries each: for entries spread over k bins,
+ * it is sqrt(k / entries). The run stops when every histogram is at least
+ * as precise as requested.
+ *
+ * A histogram with fewer than kPreviewMinEntries entries in range hasn't
+ * converged. For the first kPreviewMinRounds rounds this keeps the run
+ * going; after that, such a histogram (e.g. of a selection the sample
+ * hardly ever passes, like CCMEC on a sample without MEC) is left out, and
+ * listed in the round report, so it doesn't hold up the others.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <TChain.h>
+#include <TH1.h>
+
+/// Entries per chunk in a preview
+const long kPreviewChunk = 1000;
+
+/// Entries in range a histogram needs before its precision counts
+const double kPreviewMinEntries = 100;
+
+/// Rounds before histograms with too few entries are left out
+const int kPreviewMinRounds = 3;
+
+/// Entries in the first preview round; later rounds add a quarter of the
+/// entries read so far
+const long kPreviewRound = 20000;
+
+
+/** Shuffle v in place (Fisher-Yates), the same for a seed everywhere. */
+template<class T>
+void Shuffle(std::vector<T>& v, std::mt19937_64& rng) {
+  for (size_t i=v.size(); i>1; i--) {
+    std::swap(v[i-1], v[rng() % i]);
+  }
+}
+
+
+/**
+ * The chunks [begin, end) of the entries of a chain, in preview order
+ * (see above).
+ */
+std::vector<std::pair<long, long> > PreviewChunks(TChain* chain, long chunk,
+                                                  unsigned seed) {
+  long n = chain->GetEntries();
+  int ntrees = chain->GetNtrees();
+  const Long64_t* offset = chain->GetTreeOffset();
+
+  // The chunks of each file, in a random order
+  std::mt19937_64 rng(seed);
+  std::vector<std::vector<std::pair<long, long> > > files(ntrees);
+  size_t nchunks = 0;
+  for (int f=0; f<ntrees; f++) {
+    long first = offset[f];
+    long last = (f + 1 < ntrees ? (long) offset[f+1] : n);
+    for (long b=first; b<last; b+=chunk) {
+      files[f].push_back(std::make_pair(b, std::min(b + chunk, last)));
+    }
+    Shuffle(files[f], rng);
+    nchunks += files[f].size();
+  }
+
+  // One chunk of each file at a time
+  std::vector<int> order(ntrees);
+  for (int f=0; f<ntrees; f++) {
+    order[f] = f;
+  }
+  std::vector<std::pair<long, long> > chunks;
+  for (size_t rank=0; chunks.size()<nchunks; rank++) {
+    Shuffle(order, rng);
+    for (int f=0; f<ntrees; f++) {
+      if (rank < files[order[f]].size()) {
+        chunks.push_back(files[order[f]][rank]);
+      }
+    }
+  }
+
+  return chunks;
+}
+
+
+/**
+ * The precision (see above) of the booked histograms, summed over the
+ * workers' copies, over their in-range bins: the largest over the
+ * histograms, whose name is put in worst (0, with worst empty, if there
+ * are none). A histogram with fewer than kPreviewMinEntries entries in
+ * range counts as HUGE_VAL, or, if skipRare, is left out and its name
+ * added to rare.
+ */
+double PreviewPrecision(std::vector<Booking>& workers, bool skipRare,
+                        std::string& worst, std::vector<std::string>& rare) {
+  double largest = 0;
+  std::vector<double> sum;
+
+  for (auto const& h : workers[0]) {
+    for (auto const& hist : h.second.second) {
+      TH1* h0 = hist.second->h;
+      sum.assign(h0->GetNcells(), 0);
+      for (size_t w=0; w<workers.size(); w++) {
+        Hist* copy = workers[w][h.first].second[hist.first];
+        copy->Flush();
+        for (size_t i=0; i<sum.size(); i++) {
+          sum[i] += copy->h->GetBinContent(i);
+        }
+      }
+
+      double entries = 0, spread = 0;
+      for (size_t i=0; i<sum.size(); i++) {
+        if (!h0->IsBinUnderflow(i) && !h0->IsBinOverflow(i)) {
+          entries += sum[i];
+          spread += sqrt(sum[i]);
+        }
+      }
+      if (entries < kPreviewMinEntries && skipRare) {
+        rare.push_back(h0->GetName());
+        continue;
+      }
+      double p = (entries < kPreviewMinEntries ? HUGE_VAL : spread / entries);
+      if (p > largest || worst == "") {
+        largest = p;
+        worst = h0->GetName();
+      }
+    }
+  }
+
+  return largest;
+}
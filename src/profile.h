@@ -0,0 +1,225 @@
+/**
+ * Stage-level profiling of a run (ggst --profile).
+ *
+ * A Profile accumulates wall and CPU time per stage of the run, with a
+ * Timer scoped around each stage. Each worker thread has its own Profile,
+ * and they are added together at the end, so stage times are summed over
+ * threads (CPU time is per thread). Reading the clocks (the CPU clock is a
+ * system call) costs about as much as a small event, so the per-entry
+ * stages time one entry in kSample, scaled up to all entries (AddSampled).
+ * Alongside, it keeps the bytes read per branch, the events passing each
+ * selection and the entries in each histogram, and writes a summary and a
+ * JSON report.
+ */
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+
+class Profile {
+public:
+  /// Stages of a run
+  enum Stage { kOpen, kRead, kSelect, kFill, kWrite, kRender, kNStages };
+
+  /// Per-entry stages are timed for one entry in this many
+  static const long kSample = 64;
+
+  Profile() : entries(0), loop(0), fileBytes(0) {
+    for (int i=0; i<kNStages; i++) {
+      wall[i] = cpu[i] = 0;
+      calls[i] = 0;
+    }
+  }
+
+  static const char* StageName(int i) {
+    static const char* names[kNStages] = {
+      "open", "read", "select", "fill", "write", "render"
+    };
+    return names[i];
+  }
+
+  /** Wall clock time in seconds. */
+  static double Wall() {
+    return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /** CPU time of the calling thread in seconds. */
+  static double CPU() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+  }
+
+  /**
+   * \class Timer
+   * \brief Adds the time until it goes out of scope to a stage.
+   *
+   * Does nothing if the Profile is NULL, i.e. when not profiling.
+   */
+  class Timer {
+  public:
+    Timer(Profile* _p, Stage _stage) : p(_p), stage(_stage) {
+      if (p) {
+        wall0 = Wall();
+        cpu0 = CPU();
+      }
+    }
+
+    ~Timer() {
+      if (p) {
+        p->Stop(stage, wall0, cpu0);
+      }
+    }
+
+  private:
+    Profile* p;
+    Stage stage;
+    double wall0, cpu0;
+  };
+
+  /** Add the time since (wall0, cpu0) to a stage. */
+  void Stop(Stage stage, double wall0, double cpu0) {
+    wall[stage] += Wall() - wall0;
+    cpu[stage] += CPU() - cpu0;
+    calls[stage]++;
+  }
+
+  /**
+   * Add the stage times of a profile that timed sampled of n entries,
+   * scaled up to all n. Calls are the timed calls.
+   */
+  void AddSampled(const Profile& o, long sampled, long n) {
+    double scale = (sampled > 0 ? 1.0 * n / sampled : 0);
+    for (int i=0; i<kNStages; i++) {
+      wall[i] += o.wall[i] * scale;
+      cpu[i] += o.cpu[i] * scale;
+      calls[i] += o.calls[i];
+    }
+  }
+
+  /** A string escaped for a JSON string literal. */
+  static std::string Escape(const std::string& s) {
+    std::ostringstream out;
+    for (size_t i=0; i<s.size(); i++) {
+      unsigned char c = s[i];
+      if (c == '"' || c == '\\') {
+        out << '\\' << c;
+      }
+      else if (c < 0x20) {
+        out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+            << (int) c << std::dec << std::setfill(' ');
+      }
+      else {
+        out << c;
+      }
+    }
+    return out.str();
+  }
+
+  /** Add another worker's profile to this one. */
+  void Add(const Profile& o) {
+    for (int i=0; i<kNStages; i++) {
+      wall[i] += o.wall[i];
+      cpu[i] += o.cpu[i];
+      calls[i] += o.calls[i];
+    }
+    for (auto const& b : o.branches) {
+      branches[b.first].first += b.second.first;
+      branches[b.first].second += b.second.second;
+    }
+    for (auto const& s : o.passed) {
+      passed[s.first] += s.second;
+    }
+  }
+
+  /** Print a summary table. */
+  void Print(std::ostream& out) const {
+    out << "Profile: " << entries << " events in " << loop << " s ("
+        << (loop > 0 ? entries / loop : 0) << " events/s)" << std::endl;
+
+    out << "  " << std::setw(8) << std::left << "stage"
+        << std::setw(12) << std::right << "wall (s)"
+        << std::setw(12) << "cpu (s)" << std::setw(12) << "calls" << std::endl;
+    for (int i=0; i<kNStages; i++) {
+      out << "  " << std::setw(8) << std::left << StageName(i)
+          << std::setw(12) << std::right << wall[i]
+          << std::setw(12) << cpu[i] << std::setw(12) << calls[i] << std::endl;
+    }
+
+    out << "  File bytes read: " << fileBytes << std::endl;
+    for (auto const& b : branches) {
+      out << "  Branch " << b.first << ": " << b.second.first
+          << " compressed, " << b.second.second << " uncompressed" << std::endl;
+    }
+    for (auto const& s : passed) {
+      out << "  Selection " << s.first << ": " << s.second << std::endl;
+    }
+    for (auto const& h : filled) {
+      out << "  Histogram " << h.first << ": " << h.second << std::endl;
+    }
+  }
+
+  /** Write the report as JSON. Returns false on an I/O error. */
+  bool WriteJSON(std::string path) const {
+    std::ofstream f(path.c_str());
+    f << std::setprecision(9);
+    f << "{" << std::endl;
+    f << "  \"entries\": " << entries << "," << std::endl;
+    f << "  \"loop_wall\": " << loop << "," << std::endl;
+    f << "  \"events_per_second\": " << (loop > 0 ? entries / loop : 0) << "," << std::endl;
+    f << "  \"file_bytes_read\": " << fileBytes << "," << std::endl;
+
+    f << "  \"stages\": {";
+    for (int i=0; i<kNStages; i++) {
+      f << (i ? "," : "") << std::endl
+        << "    \"" << StageName(i) << "\": {\"wall\": " << wall[i]
+        << ", \"cpu\": " << cpu[i] << ", \"calls\": " << calls[i] << "}";
+    }
+    f << std::endl << "  }," << std::endl;
+
+    const char* sep = "";
+    f << "  \"branches\": {";
+    for (auto const& b : branches) {
+      f << sep << std::endl << "    \"" << Escape(b.first) << "\": {\"compressed\": "
+        << b.second.first << ", \"uncompressed\": " << b.second.second << "}";
+      sep = ",";
+    }
+    f << std::endl << "  }," << std::endl;
+
+    sep = "";
+    f << "  \"selections\": {";
+    for (auto const& s : passed) {
+      f << sep << std::endl << "    \"" << Escape(s.first) << "\": " << s.second;
+      sep = ",";
+    }
+    f << std::endl << "  }," << std::endl;
+
+    sep = "";
+    f << "  \"histograms\": {";
+    for (auto const& h : filled) {
+      f << sep << std::endl << "    \"" << Escape(h.first) << "\": " << h.second;
+      sep = ",";
+    }
+    f << std::endl << "  }" << std::endl;
+    f << "}" << std::endl;
+
+    return f.good();
+  }
+
+  double wall[kNStages];  //!< Wall time per stage, summed over threads
+  double cpu[kNStages];  //!< CPU time per stage
+  long calls[kNStages];  //!< Timed calls per stage
+  long entries;  //!< Events processed
+  double loop;  //!< Wall time of the event loop
+  double fileBytes;  //!< Bytes read from input files
+  std::map<std::string, std::pair<double, double> > branches;  //!< Compressed, uncompressed bytes read
+  std::map<std::string, long> passed;  //!< Events passing each selection
+  std::map<std::string, double> filled;  //!< Entries per histogram
+};
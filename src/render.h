@@ -0,0 +1,114 @@
+/**
+ * Plot rendering: canvases and PDFs for the histograms written by ggst.
+ *
+ * Used inline by ggst, or afterwards, in parallel, by ggst-render.
+ */
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <TCanvas.h>
+#include <TF1.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TPaveText.h>
+#include <TString.h>
+
+/** Create a TPaveText label with information about the GENIE config. */
+TPaveText* genie_label(TString config, TString gen) {
+    TPaveText* l = new TPaveText(0.17, 0.6, 0.62, 0.88, "ndc");
+    l->SetTextFont(132);
+    l->SetTextAlign(12);
+    l->SetBorderSize(0);
+    l->SetFillColor(0);
+    l->SetFillStyle(0);
+    l->AddText("GENIE 2.12.10, BNB #nu_{#mu}");
+    l->AddText(config);
+    l->AddText(TString("Generators: ") + gen);
+    return l;
+}
+
+
+/** Constant Q^2 = p[0] in the q3 (x) vs. q0 plane. */
+double q2_line(double* x, double* p) {
+  return sqrt(std::max(x[0] * x[0] - p[0], 0.0));
+}
+
+
+/** Constant W = p[0] in the q3 (x) vs. q0 plane. */
+double w_line(double* x, double* p) {
+  return sqrt(p[0] * p[0] + x[0] * x[0]) - 0.938;
+}
+
+
+/**
+ * Draw a histogram on a canvas, write the canvas to f, and save it as
+ * ./<config>_<gen>_c_<name>.pdf.
+ *
+ * q0q3 histograms get a label and lines of constant Q^2 and W, using
+ * compiled functions rather than formulas.
+ */
+void Render(TH1* h, TString config, TString gen, TFile* f, bool label=false) {
+  char cname[150];
+  snprintf(cname, 150, "c_%s", h->GetName());
+  TCanvas* c = new TCanvas();
+  c->SetName(cname);
+  c->SetLeftMargin(0.15);
+  h->Draw("colz");
+
+  TPaveText* l1 = NULL;
+  TPaveText* l2 = NULL;
+  std::vector<TF1*> fs;
+  if (std::string(h->GetName()).find("q0q3") != std::string::npos) {
+    // Labels
+    l1 = genie_label(config, gen);
+    l1->AddText("Lines W = 938, 1232, 1535 MeV");
+    l1->AddText("Lines Q^{2} = 0.2 - 1.0 GeV");
+    l1->Draw();
+
+    // Q2 and W lines
+    float lw = 2;
+    std::vector<double> qs = {0.2, 0.4, 0.6, 0.8, 1.0};
+    for (size_t j=0; j<qs.size(); j++) {
+      char fname[150];
+      snprintf(fname, 150, "fq_%f", qs[j] * 1000);
+      TF1* fl = new TF1(fname, q2_line, qs[j], 1.3, 1);
+      fl->SetParameter(0, qs[j]);
+      fl->SetNpx(1000);
+      fl->SetLineColor(kWhite);
+      fl->SetLineWidth(lw);
+      fl->Draw("same");
+      fs.push_back(fl);
+    }
+
+    std::vector<double> ws = {0.938, 1.232, 1.535};
+    for (size_t j=0; j<ws.size(); j++) {
+      char fname[150];
+      snprintf(fname, 150, "fw_%f", ws[j] * 1000);
+      TF1* fl = new TF1(fname, w_line, 0, 1.3, 1);
+      fl->SetParameter(0, ws[j]);
+      fl->SetNpx(1000);
+      fl->SetLineColor(kWhite);
+      fl->SetLineWidth(lw);
+      fl->Draw("same");
+      fs.push_back(fl);
+    }
+  }
+  else if (label) {
+    l2 = genie_label(config, gen);
+    l2->Draw();
+  }
+
+  c->RedrawAxis();
+  c->Update();
+  f->cd();
+  c->Write(0, TObject::kOverwrite);
+  c->SaveAs(TString("./") + config + "_" + gen + "_" + cname + ".pdf");
+
+  delete c;
+  delete l1;
+  delete l2;
+  for (size_t j=0; j<fs.size(); j++) {
+    delete fs[j];
+  }
+}
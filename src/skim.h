@@ -0,0 +1,274 @@
+/**
+ * Skims: slim copies of a sample with only the events passing one
+ * selection, for studies that go back to a single channel many times.
+ *
+ * A skim is a gst tree, so ggst reads it like any other input. It holds
+ * the branches read by its selection and that selection's histograms in
+ * the plan it was made with, and the Features of each event (the skim_*
+ * branches, with skim_valid giving the groups stored; see SkimBranches),
+ * so a SkimEvent needn't recompute them. The particle lists are trimmed to
+ * the particles the Features count (post-FSI protons and charged and
+ * neutral pions, pre-FSI protons), unless a histogram counts the list
+ * lengths, so selections and histograms give the same results on a skim
+ * as on the full sample.
+ *
+ * The skim of selection <sel> of sample <config>_<gen> is written to
+ * DIR/<config>_<gen>_<sel>/<config>_<gen>.root, so ggst finds the sample
+ * names as usual, with a "skim" tag holding the selection name, the
+ * entries skimmed and the entries in the sample.
+ */
+
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <TFile.h>
+#include <TObjString.h>
+#include <TTree.h>
+
+/** A stored group of Features: branch name, leaf list and member. */
+struct SkimBranch {
+  const char* name;
+  const char* leaf;
+  void* addr;
+};
+
+
+/** The branches holding the Features f, and the bits of those stored. */
+std::vector<SkimBranch> SkimBranches(Event::Features& f, unsigned* valid) {
+  static_assert(Event::kNPke == 2, "skim_pke leaf length");
+  SkimBranch b[] = {
+    { "skim_valid", "skim_valid/i", valid },
+    { "skim_intmode", "skim_intmode/I", &f.intmode },
+    { "skim_lmass", "skim_lmass/D", &f.lmass },
+    { "skim_q0", "skim_q0/D", &f.q0 },
+    { "skim_q3", "skim_q3/D", &f.q3 },
+    { "skim_tmu", "skim_tmu/F", &f.tmu },
+    { "skim_ctmu", "skim_ctmu/F", &f.ctmu },
+    { "skim_nfp60", "skim_nfp60/i", &f.nfp60 },
+    { "skim_nfpi0", "skim_nfpi0/i", &f.nfpi0 },
+    { "skim_nfpiq", "skim_nfpiq/i", &f.nfpiq },
+    { "skim_nip", "skim_nip/i", &f.nip },
+    { "skim_pke", "skim_pke[2]/D", f.pke },
+    { "skim_leadpke", "skim_leadpke/D", &f.leadpke }
+  };
+  return std::vector<SkimBranch>(b, b + sizeof(b) / sizeof(b[0]));
+}
+
+
+/**
+ * \class SkimEvent
+ * \brief An Event read from a skim, with the stored Features.
+ */
+class SkimEvent : public Event {
+public:
+  SkimEvent(TTree* _t) : Event(_t), stored(0) {
+    std::vector<SkimBranch> b = SkimBranches(feat, &stored);
+    for (size_t i=0; i<b.size(); i++) {
+      gst->SetBranchAddress(b[i].name, b[i].addr);
+    }
+  }
+
+  /** Whether a tree is a skim. */
+  static bool IsSkim(TTree* t) {
+    return t->GetBranch("skim_valid") != NULL;
+  }
+
+  void SetActive(const std::set<std::string>& names) {
+    Event::SetActive(names);
+    gst->SetBranchStatus("skim_*", true);
+  }
+
+  void GetEntry(long i) {
+    Event::GetEntry(i);
+    valid = stored;
+  }
+
+protected:
+  unsigned stored;  //!< Groups of Features stored for this entry
+};
+
+
+/** The groups of Features that can be computed from a set of branches. */
+unsigned SkimFeatures(const std::set<std::string>& b) {
+  auto has = [&b](const std::string& names) {
+    std::set<std::string> need;
+    Event::Need(need, names);
+    for (auto const& name : need) {
+      if (!b.count(name) && !b.count("*")) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  unsigned bits = 0;
+  if (has(Event::intmodeBranches())) bits |= Event::kMode;
+  if (has(Event::q0Branches())) bits |= Event::kQ0;
+  if (has(Event::q3Branches())) bits |= Event::kQ3;
+  if (has(Event::tmuBranches())) bits |= Event::kLmass | Event::kTmu;
+  if (has(Event::ctmuBranches())) bits |= Event::kCtmu;
+  if (has("nf pdgf Ef")) bits |= Event::kPostFSI;
+  if (has("ni pdgi Ei")) bits |= Event::kPreFSI;
+  return bits;
+}
+
+
+/** Compute the groups of Features in bits for the current entry. */
+void ComputeFeatures(Event& ev, unsigned bits) {
+  if (bits & Event::kMode) ev.intmode();
+  if (bits & Event::kQ0) ev.q0();
+  if (bits & Event::kQ3) ev.q3();
+  if (bits & (Event::kLmass | Event::kTmu)) ev.tmu();
+  if (bits & Event::kCtmu) ev.ctmu();
+  if (bits & Event::kPostFSI) ev.PostFSI();
+  if (bits & Event::kPreFSI) ev.PreFSI();
+}
+
+
+/** Keep only the particles with a PDG code in pdgs, in order. */
+template<size_t N>
+int TrimParticles(int n, const int (&pdgs)[N], int* pdg, double* e,
+                  double* px, double* py, double* pz) {
+  int kept = 0;
+  for (int i=0; i<n; i++) {
+    for (size_t j=0; j<N; j++) {
+      if (pdg[i] == pdgs[j]) {
+        pdg[kept] = pdg[i];
+        e[kept] = e[i];
+        px[kept] = px[i];
+        py[kept] = py[i];
+        pz[kept] = pz[i];
+        kept++;
+        break;
+      }
+    }
+  }
+  return kept;
+}
+
+
+/** Trim the particle lists of the current entry to those Features count. */
+void TrimParticles(Event& ev) {
+  static const int post[] = { 2212, 111, 211 };
+  static const int pre[] = { 2212 };
+  ev.nf = TrimParticles(ev.nf, post, ev.pdgf, ev.ef, ev.pxf, ev.pyf, ev.pzf);
+  ev.ni = TrimParticles(ev.ni, pre, ev.pdgi, ev.ei, ev.pxi, ev.pyi, ev.pzi);
+}
+
+
+/**
+ * Write a skim of each selection in hists, from n entries of ev (or the
+ * entries listed, if not NULL), for the sample name (<config>_<gen>), to
+ * directory dir. ev's active branches must include those read by hists.
+ *
+ * Returns the number of entries read, or -1 on error.
+ */
+long WriteSkims(Event& ev, const Booking& hists, std::string dir,
+                std::string name, const std::vector<long>* entries, long n) {
+  // Histograms of the list lengths need the full lists
+  bool trim = true;
+  for (auto const& h : hists) {
+    for (auto const& hist : h.second.second) {
+      Hist_number* hn = dynamic_cast<Hist_number*>(hist.second);
+      if (hn && (hn->number == &ev.ni || hn->number == &ev.nf)) {
+        trim = false;
+      }
+    }
+  }
+
+  mkdir(dir.c_str(), 0755);
+  std::vector<TFile*> files;
+  std::vector<TTree*> trees;
+  std::vector<unsigned> bits, stored(hists.size(), 0);
+  unsigned all = 0;
+
+  for (auto const& h : hists) {
+    std::set<std::string> branches;
+    Event::Branches(h.second.first, branches);
+    for (auto const& hist : h.second.second) {
+      hist.second->Branches(ev, branches);
+    }
+    for (size_t i=0; i<ev.bindings.size(); i++) {
+      const Event::Binding& b = ev.bindings[i];
+      if (b.count && branches.count(b.name)) {
+        branches.insert(ev.BranchName(b.count));
+      }
+    }
+
+    std::string sub = dir + "/" + name + "_" + h.first;
+    std::string path = sub + "/" + name + ".root";
+    mkdir(sub.c_str(), 0755);
+    TFile* f = TFile::Open(path.c_str(), "recreate");
+    if (!f || f->IsZombie()) {
+      std::cerr << "Cannot open " << path << std::endl;
+      for (size_t i=0; i<files.size(); i++) {
+        delete files[i];
+      }
+      delete f;
+      return -1;
+    }
+    std::cout << "Skim: " << path << std::endl;
+
+    TTree* t = new TTree("gst", "GENIE Summary Event Tree (skim)");
+    t->SetDirectory(f);
+    ev.MakeBranches(t, branches);
+    std::vector<SkimBranch> sb = SkimBranches(ev.feat, &stored[files.size()]);
+    for (size_t i=0; i<sb.size(); i++) {
+      t->Branch(sb[i].name, sb[i].addr, sb[i].leaf);
+    }
+
+    bits.push_back(SkimFeatures(branches));
+    all |= bits.back();
+    files.push_back(f);
+    trees.push_back(t);
+  }
+
+  Plan plan(hists);
+  std::vector<long> passed(trees.size(), 0);
+  for (long i=0; i<n; i++) {
+    ev.GetEntry(entries ? (*entries)[i] : i);
+    if (!ev.valid) {
+      ev.feat = Event::Features();
+    }
+
+    uint64_t mask = plan.Select(ev);
+    if (!mask) {
+      continue;
+    }
+
+    ComputeFeatures(ev, all);
+    if (trim) {
+      TrimParticles(ev);
+    }
+
+    while (mask) {
+      size_t k = __builtin_ctzll(mask);
+      mask &= mask - 1;
+      stored[k] = bits[k];
+      trees[k]->Fill();
+      passed[k]++;
+    }
+  }
+
+  size_t k = 0;
+  for (auto const& h : hists) {
+    std::cout << "Skim " << h.first << ": " << passed[k] << " of "
+              << n << " entries" << std::endl;
+
+    std::ostringstream ss;
+    ss << h.first << " " << passed[k] << " " << ev.GetEntries();
+    TObjString tag(ss.str().c_str());
+    files[k]->cd();
+    trees[k]->Write();
+    files[k]->WriteTObject(&tag, "skim");
+    files[k]->Close();
+    delete files[k];
+    k++;
+  }
+
+  return n;
+}
@@ -0,0 +1,126 @@
+/**
+ * Fine sparse histograms: a high-resolution copy of a histogram, filled
+ * alongside it, from which other binnings can be derived without
+ * rereading the events (see ggst-rebin).
+ *
+ * The fine cells subdivide each bin of the histogram k times along each
+ * axis (see Axis::FineBin), so grouping them k at a time gives back the
+ * histogram as filled, and any binning whose number of bins divides the
+ * number of fine cells can be derived exactly. Only the cells that are
+ * filled are stored, in a hash table, so memory grows with the occupied
+ * phase space rather than the number of cells, and they are written as a
+ * THnSparseD.
+ */
+
+#include <algorithm>
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <THnSparse.h>
+#include <TString.h>
+
+/**
+ * \class SparseBins
+ * \brief Contents of the filled cells of a histogram, by cell index.
+ *
+ * For 2D, the cell index is x + (nx + 2) * y, with x and y the fine bin
+ * indices (including under- and overflow) and nx the number of fine bins
+ * along x.
+ */
+class SparseBins {
+public:
+  SparseBins() : entries(0) {}
+
+  void Fill(int64_t cell) {
+    cells[cell] += 1;
+    entries++;
+  }
+
+  void Add(const SparseBins& other) {
+    for (auto const& c : other.cells) {
+      cells[c.first] += c.second;
+    }
+    entries += other.entries;
+  }
+
+  /**
+   * A THnSparseD with these contents, for ndim axes with n[i] bins over
+   * [lo[i], hi[i]). Cells are set in index order, so the output doesn't
+   * depend on the order of the fills.
+   */
+  THnSparseD* Sparse(TString name, TString title, int ndim, const int* n,
+                     const double* lo, const double* hi) const {
+    std::vector<std::pair<int64_t, double> > sorted(cells.begin(), cells.end());
+    std::sort(sorted.begin(), sorted.end());
+
+    THnSparseD* s = new THnSparseD(name, title, ndim, n, lo, hi);
+    int idx[2];
+    for (size_t i=0; i<sorted.size(); i++) {
+      int64_t cell = sorted[i].first;
+      for (int d=0; d<ndim; d++) {
+        idx[d] = cell % (n[d] + 2);
+        cell /= (n[d] + 2);
+      }
+      s->SetBinContent(idx, sorted[i].second);
+    }
+    s->SetEntries(entries);
+    return s;
+  }
+
+  std::unordered_map<int64_t, double> cells;  //!< Contents of filled cells
+  double entries;
+};
+
+
+/**
+ * A histogram H (one of the classes with a Coords method, e.g. Hist_q0q3,
+ * Hist_ke or Hist_Tct, or their universe copies) with a fine sparse copy,
+ * k cells per bin and axis.
+ *
+ * The histogram fills and writes as usual. On write, this adds
+ * <name>_fine, a THnSparseD over the same ranges with k times the bins.
+ */
+template<class H>
+class Hist_fine : public H {
+public:
+  typedef typename H::BinsType BinsType;
+
+  template<class... Args>
+  Hist_fine(int _k, Args... args) : H(args...), k(_k) {}
+
+  void Fill(Event& ev) {
+    H::Fill(ev);
+
+    double v[2];
+    if (H::Coords(ev, v)) {
+      fine.Fill(BinsType::FineCell(v, k));
+    }
+  }
+
+  void Add(Hist* other) {
+    H::Add(other);
+    fine.Add(((Hist_fine*) other)->fine);
+  }
+
+  void Write(TString config, TString gen, TFile* f, bool render=true) {
+    H::Write(config, gen, f, render);
+
+    int n[2];
+    double lo[2], hi[2];
+    BinsType::FineAxes(k, n, lo, hi);
+    THnSparseD* s = fine.Sparse(TString(H::h->GetName()) + "_fine",
+                                H::h->GetTitle(), BinsType::ndim, n, lo, hi);
+    s->GetAxis(0)->SetTitle(H::h->GetXaxis()->GetTitle());
+    if (BinsType::ndim > 1) {
+      s->GetAxis(1)->SetTitle(H::h->GetYaxis()->GetTitle());
+    }
+
+    f->cd();
+    s->Write();
+    delete s;
+  }
+
+  int k;  //!< Fine cells per bin, along each axis
+  SparseBins fine;
+};
@@ -0,0 +1,160 @@
+/**
+ * Check that the per-entry event loop makes no heap allocations.
+ *
+ * Runs process() (from ggst.cpp) with the default plan over a GST file,
+ * e.g. one written by ggst-synth, counting every malloc, calloc, realloc
+ * and operator new while it runs. Entry 0 is read first as a warm-up, so
+ * the first baskets are loaded and the Features and histograms are set up.
+ *
+ * process() builds its Plan on entry, which allocates, so the count for an
+ * empty range is subtracted. ROOT allocates when it loads a new basket,
+ * which is outside the event loop's control, so the entries checked stop
+ * at the end of the first basket of any active branch.
+ *
+ * Usage: test-alloc gntp.0.ghep.gst.root
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <TBranch.h>
+#include <TChain.h>
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#define main ggst_main
+#include "ggst.cpp"
+#undef main
+
+extern "C" {
+void* __libc_malloc(size_t n);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t n);
+}
+
+/// Whether allocations are being counted
+static std::atomic<bool> gCounting(false);
+
+/// Allocations counted
+static std::atomic<long> gAllocations(0);
+
+extern "C" {
+void* malloc(size_t n) {
+  if (gCounting) gAllocations++;
+  return __libc_malloc(n);
+}
+
+void* calloc(size_t n, size_t size) {
+  if (gCounting) gAllocations++;
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t n) {
+  if (gCounting) gAllocations++;
+  return __libc_realloc(p, n);
+}
+}
+
+void* operator new(size_t n) {
+  if (gCounting) gAllocations++;
+  void* p = __libc_malloc(n ? n : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t n) {
+  return operator new(n);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+void operator delete[](void* p) noexcept { free(p); }
+
+
+/** Allocations made by process() over entries [begin, end). */
+long count(Event& ev, Booking& hists, long begin, long end,
+           const Options& opts, const std::set<std::string>& active) {
+  gAllocations = 0;
+  gCounting = true;
+  process(ev, hists, begin, end, opts, active, NULL, NULL);
+  gCounting = false;
+  return gAllocations;
+}
+
+
+/** The first entry after the first basket of any active branch of t. */
+long first_basket_end(TTree* t) {
+  long end = t->GetEntries();
+  TIter next(t->GetListOfBranches());
+  TBranch* b;
+  while ((b = (TBranch*) next())) {
+    if (!t->GetBranchStatus(b->GetName()) || b->GetWriteBasket() < 1) {
+      continue;
+    }
+    end = std::min(end, (long) b->GetBasketEntry()[1]);
+  }
+  return end;
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    std::cout << "Usage: " << argv[0] << " gntp.0.ghep.gst.root" << std::endl;
+    return 0;
+  }
+
+  gROOT->SetBatch(true);
+  TH1::AddDirectory(false);
+
+  TFile* f = TFile::Open(argv[1]);
+  TTree* t = (f && !f->IsZombie() ? dynamic_cast<TTree*>(f->Get("gst")) : NULL);
+  if (!t) {
+    std::cerr << "Cannot read " << argv[1] << std::endl;
+    delete f;
+    return 1;
+  }
+
+  Options opts;
+  Event ev(t);
+  Booking hists;
+  if (!ReadPlan(ev, kDefaultPlan, hists)) {
+    return 1;
+  }
+
+  std::set<std::string> active;
+  for (auto const& h : hists) {
+    Event::Branches(h.second.first, active);
+    for (auto const& hist : h.second.second) {
+      hist.second->Branches(ev, active);
+    }
+  }
+  ev.SetActive(active);
+
+  // Warm up, then compare a range of entries with an empty one
+  process(ev, hists, 0, 1, opts, active, NULL, NULL);
+  long end = first_basket_end(t);
+  long base = count(ev, hists, 1, 1, opts, active);
+  long n = count(ev, hists, 1, end, opts, active) - base;
+
+  std::cout << "Allocations: " << n << " in " << end - 1 << " entries" << std::endl;
+
+  for (auto const& h : hists) {
+    for (auto const& hist : h.second.second) {
+      delete hist.second;
+    }
+  }
+  f->Close();
+  delete f;
+
+  if (end < 2) {
+    std::cerr << "Too few entries to check" << std::endl;
+    return 1;
+  }
+  return (n != 0);
+}